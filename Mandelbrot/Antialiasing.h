@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <future>
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+#include "ThreadPool.h"
+#include "Palette.h"
+#include "Mandelbrot.h"
+
+// Supersamples only the pixels of a frame that border a different iteration count, where a single
+// sample per pixel aliases. Everywhere else one sample already gives the exact palette colour.
+struct Antialiaser {
+
+	// Each supersampled pixel takes one jittered sample in each cell of a grid this size
+	static constexpr int SUBSAMPLE_GRID = 3;
+
+	static constexpr size_t PIXELS_PER_JOB = 256;
+
+	// Replaces the colours in px of the pixels of m that border a different iteration count with the
+	// average of jittered samples, taken on the pool. sample returns the iteration count at a point
+	// in pixel coordinates. Returns the number of pixels supersampled.
+	static int Antialias(const Mandelbrot& m, std::vector<uint8_t>& px, const Mandelbrot::Sampler& sample, ThreadPool& pool) {
+		std::vector<int> edges = FindEdges(m);
+
+		// Each pixel is written by one job only
+		std::vector<std::future<void>> jobs;
+		for (size_t first = 0; first < edges.size(); first += PIXELS_PER_JOB) {
+			jobs.push_back(pool.Submit([&, first] {
+				size_t last = std::min(edges.size(), first + PIXELS_PER_JOB);
+				for (size_t k = first; k < last; k++)
+					Supersample(m, px, edges[k], sample);
+				}));
+		}
+		for (auto& job : jobs)
+			job.get();
+		return (int)edges.size();
+	}
+
+private:
+
+	static std::vector<int> FindEdges(const Mandelbrot& m) {
+		std::vector<int> edges;
+		for (int y = 0; y < m.height; y++) {
+			for (int x = 0; x < m.width; x++) {
+				int i = y * m.width + x;
+				int iter = m.iterCounts[i];
+				if ((x > 0 && m.iterCounts[i - 1] != iter) ||
+					(x + 1 < m.width && m.iterCounts[i + 1] != iter) ||
+					(y > 0 && m.iterCounts[i - m.width] != iter) ||
+					(y + 1 < m.height && m.iterCounts[i + m.width] != iter))
+					edges.push_back(i);
+			}
+		}
+		return edges;
+	}
+
+	static void Supersample(const Mandelbrot& m, std::vector<uint8_t>& px, int i, const Mandelbrot::Sampler& sample) {
+		int x = i % m.width;
+		int y = i / m.width;
+
+		// The pixel's own sample counts as one of them
+		const Palette::Colour& own = Palette::Lookup(m.iterCounts[i]);
+		int r = own.r;
+		int g = own.g;
+		int b = own.b;
+		for (int gy = 0; gy < SUBSAMPLE_GRID; gy++) {
+			for (int gx = 0; gx < SUBSAMPLE_GRID; gx++) {
+				uint32_t seed = (uint32_t)i * (SUBSAMPLE_GRID * SUBSAMPLE_GRID) + gy * SUBSAMPLE_GRID + gx;
+				double sx = x - 0.5 + (gx + Jitter(2 * seed)) / SUBSAMPLE_GRID;
+				double sy = y - 0.5 + (gy + Jitter(2 * seed + 1)) / SUBSAMPLE_GRID;
+				const Palette::Colour& c = Palette::Lookup(sample(sx, sy));
+				r += c.r;
+				g += c.g;
+				b += c.b;
+			}
+		}
+
+		constexpr int SAMPLES = SUBSAMPLE_GRID * SUBSAMPLE_GRID + 1;
+		px[4 * (size_t)i + 0] = (uint8_t)(r / SAMPLES);
+		px[4 * (size_t)i + 1] = (uint8_t)(g / SAMPLES);
+		px[4 * (size_t)i + 2] = (uint8_t)(b / SAMPLES);
+	}
+
+	// Hashes n to [0, 1), so that the samples of a still view are the same every frame
+	static double Jitter(uint32_t n) {
+		n ^= n >> 16;
+		n *= 0x7feb352d;
+		n ^= n >> 15;
+		n *= 0x846ca68b;
+		n ^= n >> 16;
+		return n * 0x1p-32;
+	}
+};
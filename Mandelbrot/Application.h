@@ -2,9 +2,15 @@
 #include <Windows.h>
 #include <stdint.h>
 #include <unordered_map>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
 #include "SDL.h"
 #include "Stopwatch.h"
+#include "FloatExp.h"
+#include "BigFixed.h"
 
+// The edges of the view at float precision, for backends that iterate directly in float
 struct Viewport {
 	float xMin;
 	float yMin;
@@ -12,6 +18,14 @@ struct Viewport {
 	float yMax;
 };
 
+// A view described by its centre and the distance between neighbouring pixels, which keeps
+// its precision at zooms where the edges of a Viewport are no longer distinguishable
+struct DeepViewport {
+	Coord xCenter;
+	Coord yCenter;
+	FloatExp pixelSize;
+};
+
 [[noreturn]] inline void SdlError() {
 	throw std::runtime_error(SDL_GetError());
 }
@@ -30,6 +44,9 @@ struct Application {
 
 		hWnd = FindWindowA(nullptr, WINDOW_TITLE.c_str());
 
+		if ((wakeEvent = SDL_RegisterEvents(1)) == (uint32_t)-1)
+			goto error;
+
 		return;
 
 	error:
@@ -50,6 +67,10 @@ struct Application {
 
 			SDL_GetWindowSize(win, &clientWidth, &clientHeight);
 
+			// Cleared before Update looks at its work, so that work finishing any time after this
+			// posts a wake event of its own
+			wakePending = false;
+			woken = false;
 			Update();
 
 			// Fixed update loop
@@ -58,6 +79,7 @@ struct Application {
 			curTime += dt;
 			t += dt;
 			while (t >= FIXED_DELTA_TIME) {
+				PollEvents();
 
 				// This section is run as a fixed update because scrollDelta is used in FixedUpdate()
 				if (GetKeyDown(SDL_Scancode::SDL_SCANCODE_F11) ||
@@ -66,53 +88,135 @@ struct Application {
 					fullscreen = !fullscreen;
 					SDL_SetWindowFullscreen(win, fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0);
 				}
-				ProcessInput();
-				PollEvents();
-
-
-
-
-
 				FixedUpdate();
+
+				// Input is only spent once a fixed update has seen it
+				ProcessInput();
+				scrollDelta = 0.0f;
 				t -= FIXED_DELTA_TIME;
 			}
 
 			// Show fps in window title
 			if (secondChanged) {
-				SDL_SetWindowTitle(win, (WINDOW_TITLE + " - " + std::to_string(fps) + "fps").c_str());
+				SDL_SetWindowTitle(win, (WINDOW_TITLE + " - " + std::to_string(fps) + "fps" + renderStatus).c_str());
 				fps = 0;
 			}
 
 			Render();
+
+			// Sleep until an event arrives when nothing would change before one does. The time
+			// slept isn't simulated. A wake event already taken off the queue since Update means
+			// work finished that Update hasn't seen. The event that wakes the loop is taken off
+			// the queue straight away, so that input it brings stops the loop sleeping again.
+			if (!woken && IsIdle() && CanSleep()) {
+				Stopwatch<> slept;
+				SDL_WaitEvent(nullptr);
+				PollEvents();
+				curTime += slept.Time();
+			}
 		}
 	}
 
 	virtual void Update() = 0;
 	virtual void Render() = 0;
 	virtual void OnWindowResize(int w, int h) {}
+	virtual void OnKeyDown(SDL_Scancode code) {}
+
+	// Whether Update would do nothing until an event arrives, for backends that call Wake when
+	// their work needs attention. Otherwise the loop never sleeps.
+	virtual bool CanSleep() const { return false; }
+
+	// Wakes the main loop if it is sleeping. Can be called from any thread, and wakes it once
+	// however many times it is called before it wakes.
+	static void Wake() {
+		if (!wakePending.exchange(true)) {
+			SDL_Event ev{};
+			ev.type = wakeEvent;
+			SDL_PushEvent(&ev);
+		}
+	}
 
 protected:
 
 	Viewport GetViewport() const {
 		float aspect = (float)clientWidth / (float)clientHeight;
 
-		float h = 1.0f / zoom;
+		float h = (float)(double)ViewHeight();
 		float w = aspect * h;
 
 		Viewport vp{};
-		vp.xMin = xCam - w / 2.0f;
-		vp.yMin = yCam - h / 2.0f;
+		vp.xMin = (float)(double)xCam - w / 2.0f;
+		vp.yMin = (float)(double)yCam - h / 2.0f;
 		vp.xMax = vp.xMin + w;
 		vp.yMax = vp.yMin + h;
 		return vp;
 	}
 
+	bool IsCameraMoving() const {
+		return xCamVel != 0.0f || yCamVel != 0.0f || zoomVel != 0.0f;
+	}
+
+	bool IsCameraZooming() const {
+		return zoomVel != 0.0f;
+	}
+
+	// The view the camera comes to rest at if there is no more input, from the damping of its
+	// velocities. The zoom is approximated as if it didn't affect the speed of panning.
+	DeepViewport GetPredictedDeepViewport() const {
+		constexpr double REMAINING = 1.0 / (1.0 - VELOCITY_DAMPING);
+		FloatExp viewHeight = ViewHeight();
+		double logZoomChange = std::log2(1.0 + zoomVel) * VELOCITY_DAMPING * REMAINING;
+
+		DeepViewport vp{};
+		vp.xCenter = xCam + Coord(FloatExp(xCamVel * REMAINING) * viewHeight);
+		vp.yCenter = yCam + Coord(FloatExp(yCamVel * REMAINING) * viewHeight);
+		vp.pixelSize = viewHeight * FloatExp(std::exp2(-logZoomChange)) / FloatExp(clientHeight);
+		return vp;
+	}
+
+	// Where the user is presumably looking in window pixels, which is the cursor while it is over
+	// the window and otherwise the centre
+	void GetFocus(double& x, double& y) const {
+		int mouseX = 0;
+		int mouseY = 0;
+		if (SDL_GetMouseFocus() == win) {
+			SDL_GetMouseState(&mouseX, &mouseY);
+			x = mouseX;
+			y = mouseY;
+		} else {
+			x = clientWidth * 0.5;
+			y = clientHeight * 0.5;
+		}
+	}
+
+	// Moves the camera to (x, y) and stops it panning
+	void CentreOn(const Coord& x, const Coord& y) {
+		xCam = x;
+		yCam = y;
+		xCamVel = 0.0f;
+		yCamVel = 0.0f;
+	}
+
+	DeepViewport GetDeepViewport() const {
+		DeepViewport vp{};
+		vp.xCenter = xCam;
+		vp.yCenter = yCam;
+		vp.pixelSize = ViewHeight() / FloatExp(clientHeight);
+		return vp;
+	}
+
 	SDL_Window* win = nullptr;
 	HWND hWnd = NULL;
 	int clientWidth;
 	int clientHeight;
 	int fps = 0;
 
+	// Zooming stops before pixels get smaller than this, for backends with limited precision
+	double minPixelSize = 0.0;
+
+	// Set by backends to report on their rendering, and shown in the window title after the fps
+	std::string renderStatus;
+
 private:
 
 	void Cleanup() {
@@ -122,10 +226,17 @@ private:
 		SDL_Quit();
 	}
 
+	// Height of the view in the complex plane
+	FloatExp ViewHeight() const {
+		double whole = std::floor(logZoom);
+		return FloatExp(std::exp2(whole - logZoom), -(int64_t)whole);
+	}
+
 	void FixedUpdate() {
 
-		// Update camera position
-		float camSpeed = FIXED_DELTA_TIME * 0.01f / zoom;
+		// Update camera position. Velocities are in view heights so that only the final
+		// step into the camera position has to be done at full precision.
+		float camSpeed = FIXED_DELTA_TIME * 0.01f;
 		if (GetKey(SDL_Scancode::SDL_SCANCODE_A))
 			xCamVel -= camSpeed;
 		if (GetKey(SDL_Scancode::SDL_SCANCODE_D))
@@ -134,24 +245,45 @@ private:
 			yCamVel -= camSpeed;
 		if (GetKey(SDL_Scancode::SDL_SCANCODE_S))
 			yCamVel += camSpeed;
-		xCam += xCamVel;
-		yCam += yCamVel;
-		xCamVel *= 0.95f;
-		yCamVel *= 0.95f;
+		FloatExp viewHeight = ViewHeight();
+		xCam += Coord(FloatExp(xCamVel) * viewHeight);
+		yCam += Coord(FloatExp(yCamVel) * viewHeight);
+		xCamVel = Decay(xCamVel);
+		yCamVel = Decay(yCamVel);
+
+		// Update zoom. The velocity is relative to the current zoom, and can't zoom out by the whole
+		// view or more in one step, which would take the log of 0 or less.
+		zoomVel += scrollDelta * FIXED_DELTA_TIME * 0.1f;
+		zoomVel = std::max(Decay(zoomVel), -0.99f);
+		logZoom += std::log2(1.0 + zoomVel);
+		logZoom = std::max(logZoom, std::log2(0.1));
+		logZoom = std::min(logZoom, -MIN_LOG2_PIXEL_SIZE - std::log2(clientHeight));
+		if (minPixelSize > 0.0)
+			logZoom = std::min(logZoom, -std::log2(minPixelSize * clientHeight));
+	}
 
-		// Update zoom
-		zoomVel += scrollDelta * FIXED_DELTA_TIME * 0.1f * zoom;
-		zoomVel *= 0.95f;
-		zoom += zoomVel;
-		if (zoom < 0.1f)
-			zoom = 0.1f;
+	// True if the camera is still and no input is waiting to be handled by a fixed update
+	bool IsIdle() const {
+		if (IsCameraMoving() || scrollDelta != 0.0f)
+			return false;
+		for (const auto& key : keyPhases)
+			if (key.second != KeyPhase::NotHeld)
+				return false;
+		return true;
 	}
 
-	void PollEvents() {
-		scrollDelta = 0.0f;
+	// Slows a velocity down, stopping it once the view moves by only a pixel or so a second
+	static float Decay(float vel) {
+		vel *= VELOCITY_DAMPING;
+		return std::abs(vel) < STOP_SPEED ? 0.0f : vel;
+	}
 
+	// Adds events to the input, which the next fixed update spends
+	void PollEvents() {
 		SDL_Event ev{};
 		while (SDL_PollEvent(&ev)) {
+			if (ev.type == wakeEvent)
+				woken = true;
 			switch (ev.type) {
 			case SDL_EventType::SDL_QUIT:
 				quit = true;
@@ -166,6 +298,7 @@ private:
 				break;
 			case SDL_EventType::SDL_KEYDOWN:
 				keyPhases[ev.key.keysym.scancode] = KeyPhase::JustHeld;
+				OnKeyDown(ev.key.keysym.scancode);
 				break;
 			case SDL_EventType::SDL_KEYUP:
 				keyPhases[ev.key.keysym.scancode] = KeyPhase::JustReleased;
@@ -203,11 +336,19 @@ private:
 	}
 
 	static constexpr float FIXED_DELTA_TIME = 1.0f / 200.0f;
+	static constexpr float STOP_SPEED = 1e-5f;
+	static constexpr float VELOCITY_DAMPING = 0.95f;
 	inline static const std::string WINDOW_TITLE = "Mandelbrot Set";
 
 	bool quit = false;
 	bool fullscreen = false;
 
+	// The user event that Wake posts, whether one has been posted since the last Update, and
+	// whether one has been taken off the queue since
+	inline static uint32_t wakeEvent = (uint32_t)-1;
+	inline static std::atomic<bool> wakePending = false;
+	bool woken = false;
+
 	// Input properties
 	float scrollDelta = 0.0f;
 	enum class KeyPhase {
@@ -218,11 +359,12 @@ private:
 	};
 	std::unordered_map<SDL_Scancode, KeyPhase> keyPhases;
 
-	// View properties
-	float zoom = 0.3f;
+	// View properties. The zoom is stored as its log2 and the position in a Coord, so that they
+	// don't run out of range or precision down to pixels of 2^MIN_LOG2_PIXEL_SIZE, where zooming stops.
+	double logZoom = std::log2(0.3);
 	float zoomVel = 0.0f;
-	float xCam = 0.0f;
-	float yCam = 0.0f;
+	Coord xCam;
+	Coord yCam;
 	float xCamVel = 0.0f;
 	float yCamVel = 0.0f;
 };
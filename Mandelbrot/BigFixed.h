@@ -0,0 +1,359 @@
+#pragma once
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include "FloatExp.h"
+
+// Raw operations on little endian arrays of 32 bit limbs shared by all BigFixed sizes
+namespace Limbs {
+
+	// Squaring switches from schoolbook to Karatsuba at this many limbs
+	constexpr size_t KARATSUBA_THRESHOLD = 48;
+
+	// Number of scratch limbs that Square needs for an n limb operand
+	constexpr size_t SquareScratchSize(size_t n) {
+		return 4 * n + 64;
+	}
+
+	// a[0, an) += b[0, bn), returns the carry out of a
+	inline uint32_t Add(uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+		uint64_t carry = 0;
+		size_t i = 0;
+		for (; i < bn; i++) {
+			uint64_t t = (uint64_t)a[i] + b[i] + carry;
+			a[i] = (uint32_t)t;
+			carry = t >> 32;
+		}
+		for (; carry && i < an; i++) {
+			uint64_t t = (uint64_t)a[i] + carry;
+			a[i] = (uint32_t)t;
+			carry = t >> 32;
+		}
+		return (uint32_t)carry;
+	}
+
+	// a[0, an) -= b[0, bn), returns the borrow out of a
+	inline uint32_t Sub(uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+		uint64_t borrow = 0;
+		size_t i = 0;
+		for (; i < bn; i++) {
+			uint64_t t = (uint64_t)a[i] - b[i] - borrow;
+			a[i] = (uint32_t)t;
+			borrow = (t >> 32) & 1;
+		}
+		for (; borrow && i < an; i++) {
+			uint64_t t = (uint64_t)a[i] - borrow;
+			a[i] = (uint32_t)t;
+			borrow = (t >> 32) & 1;
+		}
+		return (uint32_t)borrow;
+	}
+
+	// r[0, 2n) = a[0, n)^2, computing each cross product once
+	inline void SquareSchoolbook(uint32_t* r, const uint32_t* a, size_t n) {
+		std::fill(r, r + 2 * n, 0);
+
+		for (size_t i = 0; i < n; i++) {
+			uint64_t carry = 0;
+			for (size_t j = i + 1; j < n; j++) {
+				uint64_t t = (uint64_t)a[i] * a[j] + r[i + j] + carry;
+				r[i + j] = (uint32_t)t;
+				carry = t >> 32;
+			}
+			r[i + n] = (uint32_t)carry;
+		}
+
+		// Double the cross products
+		for (size_t i = 2 * n - 1; i > 0; i--)
+			r[i] = (r[i] << 1) | (r[i - 1] >> 31);
+		r[0] <<= 1;
+
+		// Add the squares on the diagonal
+		uint64_t carry = 0;
+		for (size_t i = 0; i < n; i++) {
+			uint64_t sq = (uint64_t)a[i] * a[i];
+			uint64_t t = (uint64_t)r[2 * i] + (uint32_t)sq + carry;
+			r[2 * i] = (uint32_t)t;
+			t = (uint64_t)r[2 * i + 1] + (sq >> 32) + (t >> 32);
+			r[2 * i + 1] = (uint32_t)t;
+			carry = t >> 32;
+		}
+	}
+
+	// r[0, 2n) = a[0, n)^2. scratch must hold SquareScratchSize(n) limbs.
+	inline void Square(uint32_t* r, const uint32_t* a, size_t n, uint32_t* scratch) {
+		if (n < KARATSUBA_THRESHOLD) {
+			SquareSchoolbook(r, a, n);
+			return;
+		}
+
+		// With a = hi * B^lo + lo, a^2 = hi^2 * B^2lo + 2 * hi * lo * B^lo + lo^2
+		// and 2 * hi * lo = (hi + lo)^2 - hi^2 - lo^2
+		size_t lo = n / 2;
+		size_t hi = n - lo;
+		Square(r, a, lo, scratch);
+		Square(r + 2 * lo, a + lo, hi, scratch);
+
+		size_t m = hi + 1;
+		uint32_t* sum = scratch;
+		uint32_t* sumSq = scratch + m;
+		std::copy(a + lo, a + n, sum);
+		sum[hi] = Add(sum, hi, a, lo);
+		Square(sumSq, sum, m, scratch + 3 * m);
+
+		Sub(sumSq, 2 * m, r, 2 * lo);
+		Sub(sumSq, 2 * m, r + 2 * lo, 2 * hi);
+		Add(r + lo, 2 * n - lo, sumSq, std::min(2 * m, 2 * n - lo));
+	}
+
+	// r[0, an + bn) = a[0, an) * b[0, bn)
+	inline void Multiply(uint32_t* r, const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+		std::fill(r, r + an + bn, 0);
+		for (size_t i = 0; i < an; i++) {
+			uint64_t carry = 0;
+			for (size_t j = 0; j < bn; j++) {
+				uint64_t t = (uint64_t)a[i] * b[j] + r[i + j] + carry;
+				r[i + j] = (uint32_t)t;
+				carry = t >> 32;
+			}
+			r[i + bn] = (uint32_t)carry;
+		}
+	}
+}
+
+// Signed fixed point number held in two's complement across a fixed number of 32 bit limbs.
+// The top limb is the integer part and the rest are the fraction, which is plenty of range
+// for Mandelbrot orbits. Nothing is ever allocated on the heap.
+template <size_t LimbCount>
+struct BigFixed {
+	static_assert(LimbCount >= 2, "BigFixed needs at least one fraction limb");
+
+	static constexpr size_t FRACTION_LIMBS = LimbCount - 1;
+	static constexpr int FRACTION_BITS = 32 * (int)FRACTION_LIMBS;
+
+	BigFixed() :
+		limbs{} {
+	}
+
+	explicit BigFixed(double d) :
+		limbs{} {
+		bool negative = d < 0.0;
+		double a = std::abs(d);
+
+		// Peel off 32 bits at a time, which is exact since a only ever loses high bits
+		double integer = std::floor(a);
+		limbs[FRACTION_LIMBS] = (uint32_t)integer;
+		a -= integer;
+		for (size_t i = FRACTION_LIMBS; i-- > 0 && a != 0.0;) {
+			a = std::ldexp(a, 32);
+			integer = std::floor(a);
+			limbs[i] = (uint32_t)integer;
+			a -= integer;
+		}
+
+		if (negative)
+			Negate();
+	}
+
+	// Bits below the last fraction limb are truncated
+	explicit BigFixed(const FloatExp& f) :
+		limbs{} {
+		if (f.mantissa == 0.0)
+			return;
+
+		// The mantissa as a 53 bit integer whose lowest bit has weight 2^shift within the limbs
+		uint64_t m = (uint64_t)std::ldexp(std::abs(f.mantissa), 53);
+		int64_t shift = f.exponent - 53 + FRACTION_BITS;
+		if (shift <= -64)
+			return;
+		if (shift < 0) {
+			m >>= -shift;
+			shift = 0;
+		}
+
+		size_t limb = (size_t)(shift / 32);
+		int bit = (int)(shift % 32);
+		uint32_t parts[3] = {
+			(uint32_t)(m << bit),
+			(uint32_t)((m << bit) >> 32),
+			bit ? (uint32_t)(m >> (64 - bit)) : 0,
+		};
+		for (size_t i = 0; i < 3 && limb + i < LimbCount; i++)
+			limbs[limb + i] = parts[i];
+
+		if (f.mantissa < 0.0)
+			Negate();
+	}
+
+	// Converts between precisions, truncating or zero extending the fraction
+	template <size_t OtherCount>
+	explicit BigFixed(const BigFixed<OtherCount>& other) :
+		limbs{} {
+		size_t n = std::min(LimbCount, OtherCount);
+		std::copy(
+			other.limbs + OtherCount - n,
+			other.limbs + OtherCount,
+			limbs + LimbCount - n
+		);
+	}
+
+	explicit operator double() const {
+		BigFixed a = IsNegative() ? -*this : *this;
+
+		size_t top = LimbCount;
+		while (top-- > 0 && a.limbs[top] == 0) {}
+		if (top == (size_t)-1)
+			return 0.0;
+
+		// Three limbs cover a double's mantissa
+		double d = 0.0;
+		for (size_t i = top + 1; i-- > 0 && i + 3 > top;)
+			d += std::ldexp((double)a.limbs[i], 32 * ((int)i - (int)FRACTION_LIMBS));
+		return IsNegative() ? -d : d;
+	}
+
+	// Unlike double, keeps the magnitude of values too small for double's exponent
+	explicit operator FloatExp() const {
+		BigFixed a = IsNegative() ? -*this : *this;
+
+		size_t top = LimbCount;
+		while (top-- > 0 && a.limbs[top] == 0) {}
+		if (top == (size_t)-1)
+			return FloatExp();
+
+		double d = 0.0;
+		for (size_t i = top + 1; i-- > 0 && i + 3 > top;)
+			d += std::ldexp((double)a.limbs[i], 32 * ((int)i - (int)top));
+		FloatExp f(d, 32 * ((int64_t)top - (int64_t)FRACTION_LIMBS));
+		return IsNegative() ? -f : f;
+	}
+
+	// Decimal representation truncated to the given number of fraction digits
+	std::string ToString(int digits) const {
+		BigFixed a = IsNegative() ? -*this : *this;
+		std::string s = IsNegative() ? "-" : "";
+		s += std::to_string(a.limbs[FRACTION_LIMBS]);
+		s += '.';
+
+		// Multiplying the fraction by 10 carries the next digit into the integer limb
+		for (int i = 0; i < digits; i++) {
+			a.limbs[FRACTION_LIMBS] = 0;
+			uint64_t carry = 0;
+			for (size_t k = 0; k < LimbCount; k++) {
+				uint64_t t = (uint64_t)a.limbs[k] * 10 + carry;
+				a.limbs[k] = (uint32_t)t;
+				carry = t >> 32;
+			}
+			s += (char)('0' + a.limbs[FRACTION_LIMBS]);
+		}
+		return s;
+	}
+
+	bool IsNegative() const {
+		return limbs[LimbCount - 1] >> 31;
+	}
+
+	BigFixed operator-() const {
+		BigFixed r = *this;
+		r.Negate();
+		return r;
+	}
+
+	BigFixed& operator+=(const BigFixed& rhs) {
+		Limbs::Add(limbs, LimbCount, rhs.limbs, LimbCount);
+		return *this;
+	}
+
+	BigFixed& operator-=(const BigFixed& rhs) {
+		Limbs::Sub(limbs, LimbCount, rhs.limbs, LimbCount);
+		return *this;
+	}
+
+	BigFixed operator+(const BigFixed& rhs) const {
+		BigFixed r = *this;
+		r += rhs;
+		return r;
+	}
+
+	BigFixed operator-(const BigFixed& rhs) const {
+		BigFixed r = *this;
+		r -= rhs;
+		return r;
+	}
+
+	bool operator==(const BigFixed& rhs) const {
+		return std::equal(limbs, limbs + LimbCount, rhs.limbs);
+	}
+
+	bool operator!=(const BigFixed& rhs) const {
+		return !(*this == rhs);
+	}
+
+	BigFixed Squared() const {
+		BigFixed a = IsNegative() ? -*this : *this;
+		uint32_t product[2 * LimbCount];
+		uint32_t scratch[Limbs::SquareScratchSize(LimbCount)];
+		Limbs::Square(product, a.limbs, LimbCount, scratch);
+		return FromProduct(product, false);
+	}
+
+	BigFixed operator*(const BigFixed& rhs) const {
+		BigFixed a = IsNegative() ? -*this : *this;
+		BigFixed b = rhs.IsNegative() ? -rhs : rhs;
+		uint32_t product[2 * LimbCount];
+		Limbs::Multiply(product, a.limbs, LimbCount, b.limbs, LimbCount);
+		return FromProduct(product, IsNegative() != rhs.IsNegative());
+	}
+
+	uint32_t limbs[LimbCount];
+
+private:
+
+	void Negate() {
+		for (uint32_t& limb : limbs)
+			limb = ~limb;
+		uint32_t one = 1;
+		Limbs::Add(limbs, LimbCount, &one, 1);
+	}
+
+	// Drops the extra fraction limbs of a full width product
+	static BigFixed FromProduct(const uint32_t* product, bool negative) {
+		BigFixed r;
+		std::copy(product + FRACTION_LIMBS, product + FRACTION_LIMBS + LimbCount, r.limbs);
+		if (negative)
+			r.Negate();
+		return r;
+	}
+};
+
+// Coordinates are stored at the widest precision and truncated for iteration
+constexpr size_t COORD_LIMBS = 128;
+using Coord = BigFixed<COORD_LIMBS>;
+
+// Fraction bits needed to iterate an orbit accurately enough for a given pixel size
+inline int PrecisionBits(const FloatExp& pixelSize) {
+	return std::max(32, (int)std::ceil(-Log2(pixelSize)) + 64);
+}
+
+// The log2 of the smallest pixel size whose PrecisionBits a Coord still holds, about 1e-1204
+constexpr int MIN_LOG2_PIXEL_SIZE = 64 - Coord::FRACTION_BITS;
+
+// Calls fn with a default constructed BigFixed of the narrowest size with at least the given
+// number of fraction bits, so that the precision can be chosen at runtime
+template <class Fn>
+auto WithPrecision(int bits, Fn&& fn) {
+	if (bits <= BigFixed<2>::FRACTION_BITS) return fn(BigFixed<2>());
+	if (bits <= BigFixed<3>::FRACTION_BITS) return fn(BigFixed<3>());
+	if (bits <= BigFixed<4>::FRACTION_BITS) return fn(BigFixed<4>());
+	if (bits <= BigFixed<6>::FRACTION_BITS) return fn(BigFixed<6>());
+	if (bits <= BigFixed<8>::FRACTION_BITS) return fn(BigFixed<8>());
+	if (bits <= BigFixed<12>::FRACTION_BITS) return fn(BigFixed<12>());
+	if (bits <= BigFixed<16>::FRACTION_BITS) return fn(BigFixed<16>());
+	if (bits <= BigFixed<24>::FRACTION_BITS) return fn(BigFixed<24>());
+	if (bits <= BigFixed<32>::FRACTION_BITS) return fn(BigFixed<32>());
+	if (bits <= BigFixed<48>::FRACTION_BITS) return fn(BigFixed<48>());
+	if (bits <= BigFixed<64>::FRACTION_BITS) return fn(BigFixed<64>());
+	if (bits <= BigFixed<96>::FRACTION_BITS) return fn(BigFixed<96>());
+	return fn(BigFixed<COORD_LIMBS>());
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "Complex.h"
+#include "FloatExp.h"
+#include "ReferenceOrbit.h"
+
+// Bilinear approximation dz_{m+l} = a dz_m + b dc of l perturbation iterations starting at
+// reference iteration m. It holds while |dz_m| < r, where the dropped dz^2 terms are negligible.
+template <class Real>
+struct BlaStep {
+	ComplexT<Real> a;
+	ComplexT<Real> b;
+	Real r = 0.0;
+	int l = 0;
+};
+
+// Bilinear approximations over the whole reference orbit, built hierarchically: level k holds
+// steps of 2^k iterations, each merged from two adjacent steps of level k - 1.
+// It only depends on the reference orbit and the view radius so it is shared by all pixels.
+template <class Real>
+struct BlaTable {
+	using Step = BlaStep<Real>;
+
+	// Relative size of the dropped dz^2 term allowed in a single step. Anything larger than
+	// double's epsilon visibly shifts escape times near the boundary.
+	static constexpr double EPSILON = 0x1p-53;
+
+	// dcMax is the largest |dc| of any pixel that will use the table
+	static BlaTable Compute(const ReferenceOrbit& ref, Real dcMax) {
+		BlaTable t;
+
+		// Level 0 steps the iteration from m to m + 1 for m >= 1, since Z_0 is always 0
+		std::vector<Step> level;
+		int len = ref.Length();
+		for (int m = 1; m < len; m++) {
+			Step s;
+			s.a = ComplexT<Real>(ref.z[m] * 2.0);
+			s.b = ComplexT<Real>(Real(1.0), Real(0.0));
+			s.r = Real(EPSILON) * Sqrt(s.a.AbsSquared());
+			s.l = 1;
+			level.push_back(s);
+		}
+
+		while (level.size() > 1) {
+			std::vector<Step> next;
+			next.reserve(level.size() / 2);
+			for (size_t k = 0; k + 1 < level.size(); k += 2)
+				next.push_back(Merge(level[k], level[k + 1], dcMax));
+			t.levels.push_back(std::move(level));
+			level = std::move(next);
+		}
+		if (!level.empty())
+			t.levels.push_back(std::move(level));
+		return t;
+	}
+
+	// Finds the longest step from reference iteration m that is valid for |dz|^2 = dzAbsSquared
+	// and is no longer than maxLength iterations. Returns nullptr if there is none.
+	const Step* Lookup(int m, const Real& dzAbsSquared, int maxLength) const {
+		if (m < 1 || levels.empty())
+			return nullptr;
+
+		// A merged step is never valid for a larger dz than the first step it contains,
+		// so climb the levels until a step is invalid or no longer starts at m
+		const Step* best = nullptr;
+		size_t offset = (size_t)m - 1;
+		for (size_t k = 0; k < levels.size(); k++) {
+			size_t index = offset >> k;
+			if ((index << k) != offset || index >= levels[k].size() || ((size_t)1 << k) > (size_t)maxLength)
+				break;
+
+			const Step& s = levels[k][index];
+			if (dzAbsSquared >= s.r * s.r)
+				break;
+			best = &s;
+		}
+		return best;
+	}
+
+	std::vector<std::vector<Step>> levels;
+
+private:
+
+	// Returns the step that applies x and then y
+	static Step Merge(const Step& x, const Step& y, const Real& dcMax) {
+		Step s;
+		s.a = y.a * x.a;
+		s.b = y.a * x.b + y.b;
+		Real ax = Sqrt(x.a.AbsSquared());
+		Real bx = Sqrt(x.b.AbsSquared());
+		s.r = std::max(Real(0.0), std::min(x.r, (y.r - bx * dcMax) / ax));
+		s.l = x.l + y.l;
+		return s;
+	}
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <vector>
+#include <future>
+#include <algorithm>
+#include <cstdlib>
+#include <initializer_list>
+#include <stdint.h>
+#include "ThreadPool.h"
+#include "Mandelbrot.h"
+#include "Reprojection.h"
+
+// Renders half the pixels of a frame in a checkerboard whose phase alternates between frames, and
+// reconstructs the other half from the previous frame and the pixels around them
+struct Checkerboard {
+
+	// How far outside the range of its neighbours, in each colour channel, a reprojected pixel can
+	// be and still be trusted
+	static constexpr int NEIGHBOUR_TOLERANCE = 8;
+
+	// Whether pixel (x, y) is rendered in frames of the given parity
+	static bool IsRendered(int x, int y, int parity) {
+		return ((x + y + parity) & 1) == 0;
+	}
+
+	// Samples the rendered pixels of a frame a row at a time on the pool. The others have an
+	// iteration count of 0 until they are reconstructed, as do the rows left once cancel is set.
+	// The frame reuses the memory of into.
+	static Mandelbrot Compute(const Mandelbrot::Sampler& sample, int xPx, int yPx, int parity, ThreadPool& pool, CancellationToken cancel = {}, Mandelbrot into = {}) {
+		Mandelbrot m = Mandelbrot::Blank(xPx, yPx, std::move(into));
+
+		std::vector<std::future<void>> rows;
+		for (int y = 0; y < yPx; y++) {
+			rows.push_back(pool.Submit([&, y] {
+				if (cancel.IsCancelled())
+					return;
+				for (int x = (y + parity) & 1; x < xPx; x += 2)
+					m.iterCounts[(size_t)y * xPx + x] = sample(x, y);
+				}));
+		}
+		for (auto& row : rows)
+			row.get();
+		return m;
+	}
+
+	// Fills in the pixels of px that weren't rendered. Each takes the colour of the nearest pixel of
+	// the previous frame if that is consistent with its rendered neighbours, and is otherwise
+	// interpolated between the pair of opposite neighbours that differ the least, so that edges
+	// aren't blurred across. previous may be empty if there is no usable previous frame.
+	static void Reconstruct(std::vector<uint8_t>& px, int width, int height, int parity, const std::vector<uint8_t>& previous, const Reprojection& reprojection) {
+		bool reproject = previous.size() == px.size();
+		for (int y = 0; y < height; y++) {
+			for (int x = (y + parity + 1) & 1; x < width; x += 2) {
+				uint8_t* out = &px[4 * ((size_t)y * width + x)];
+				const uint8_t* left = x > 0 ? out - 4 : nullptr;
+				const uint8_t* right = x + 1 < width ? out + 4 : nullptr;
+				const uint8_t* up = y > 0 ? out - 4 * (size_t)width : nullptr;
+				const uint8_t* down = y + 1 < height ? out + 4 * (size_t)width : nullptr;
+
+				int ox, oy;
+				if (reproject && reprojection.Map(x, y, width, height, ox, oy)) {
+					const uint8_t* old = &previous[4 * ((size_t)oy * width + ox)];
+					if (IsConsistent(old, { left, right, up, down })) {
+						std::copy(old, old + 4, out);
+						continue;
+					}
+				}
+
+				Interpolate(out, left, right, up, down);
+			}
+		}
+	}
+
+private:
+
+	static bool IsConsistent(const uint8_t* colour, std::initializer_list<const uint8_t*> neighbours) {
+		for (int c = 0; c < 3; c++) {
+			int lo = 255;
+			int hi = 0;
+			for (const uint8_t* n : neighbours) {
+				if (n) {
+					lo = std::min(lo, (int)n[c]);
+					hi = std::max(hi, (int)n[c]);
+				}
+			}
+			if (colour[c] < lo - NEIGHBOUR_TOLERANCE || colour[c] > hi + NEIGHBOUR_TOLERANCE)
+				return false;
+		}
+		return true;
+	}
+
+	static void Interpolate(uint8_t* out, const uint8_t* left, const uint8_t* right, const uint8_t* up, const uint8_t* down) {
+		// Along the image border only one of a pair may exist
+		if (!left) left = right;
+		if (!right) right = left;
+		if (!up) up = down;
+		if (!down) down = up;
+
+		const uint8_t* a = left ? left : up;
+		const uint8_t* b = right ? right : down;
+		if (left && up && Difference(up, down) < Difference(left, right)) {
+			a = up;
+			b = down;
+		}
+		for (int c = 0; c < 3; c++)
+			out[c] = (uint8_t)((a[c] + b[c] + 1) / 2);
+		out[3] = 255;
+	}
+
+	static int Difference(const uint8_t* a, const uint8_t* b) {
+		return std::abs(a[0] - b[0]) + std::abs(a[1] - b[1]) + std::abs(a[2] - b[2]);
+	}
+};
@@ -1,5 +1,9 @@
 #pragma once
 #include "SdlApp.h"
+#include "Mandelbrot.h"
+#include "Checkerboard.h"
+#include "DynamicResolution.h"
+#include "NucleusFinder.h"
 
 #define CL_TARGET_OPENCL_VERSION 120
 #include "CL/CL.h"
@@ -24,8 +28,28 @@ constant const char PALETTE[16 * 4] = {
 	106,  52,   3, 255,
 };
 
-kernel void mandelbrot(float xMin, float dx, float yMin, float dy, int xPx, global char* out) {
+void write_colour(global char* out, int id, unsigned int i) {
+	i %= 16;
+	out[id * 4 + 0] = PALETTE[i * 4 + 0];
+	out[id * 4 + 1] = PALETTE[i * 4 + 1];
+	out[id * 4 + 2] = PALETTE[i * 4 + 2];
+	out[id * 4 + 3] = 255;
+}
+
+// Maps a work item to its pixel. With a parity of 0 or 1 only every other pixel is rendered, in a
+// checkerboard whose phase is the parity, and there is a work item for each of those pixels only.
+int pixel_id(int xPx, int parity) {
 	int id = (int)get_global_id(0);
+	if (parity < 0)
+		return id;
+	int half = xPx / 2;
+	int y = id / half;
+	int x = 2 * (id % half) + ((y + parity) & 1);
+	return y * xPx + x;
+}
+
+kernel void mandelbrot(float xMin, float dx, float yMin, float dy, int xPx, global char* out, int parity) {
+	int id = pixel_id(xPx, parity);
 	int x = id % xPx;
 	int y = id / xPx;
 
@@ -42,11 +66,47 @@ kernel void mandelbrot(float xMin, float dx, float yMin, float dy, int xPx, glob
 			break;
 	}
 
-	i %= 16;
-	out[id * 4 + 0] = PALETTE[i * 4 + 0];
-	out[id * 4 + 1] = PALETTE[i * 4 + 1];
-	out[id * 4 + 2] = PALETTE[i * 4 + 2];
-	out[id * 4 + 3] = 255;
+	write_colour(out, id, i);
+}
+
+// Iterates the difference dz between each pixel's orbit and a reference orbit computed on the host
+kernel void mandelbrot_perturbed(global const float2* ref, int refLen, float dxMin, float dx, float dyMin, float dy, int xPx, int maxIter, global const float2* series, int seriesTerms, int seriesSkip, float seriesInvRadius, global char* out, int parity) {
+	int id = pixel_id(xPx, parity);
+	int x = id % xPx;
+	int y = id / xPx;
+
+	float2 dc = (float2)(dxMin + dx * x, dyMin + dy * y);
+
+	// Start from the series approximation of dz at iteration seriesSkip
+	float2 u = dc * seriesInvRadius;
+	float2 dz = (float2)(0, 0);
+	for (int k = seriesTerms - 1; k >= 0; k--) {
+		float2 a = dz + series[k];
+		dz = (float2)(a.x * u.x - a.y * u.y, a.x * u.y + a.y * u.x);
+	}
+
+	int n = seriesSkip;
+	int i;
+	for (i = seriesSkip; i < maxIter; i++) {
+		float2 zr = ref[n];
+		dz = (float2)(
+			2.0f * (zr.x * dz.x - zr.y * dz.y) + dz.x * dz.x - dz.y * dz.y,
+			2.0f * (zr.x * dz.y + zr.y * dz.x) + 2.0f * dz.x * dz.y
+		) + dc;
+		n++;
+
+		float2 z = ref[n] + dz;
+		if (z.x * z.x + z.y * z.y > 4.0f)
+			break;
+
+		// Rebase onto the start of the reference once z is nearer zero than dz or the reference has escaped
+		if (z.x * z.x + z.y * z.y < dz.x * dz.x + dz.y * dz.y || n == refLen) {
+			dz = z;
+			n = 0;
+		}
+	}
+
+	write_colour(out, id, (unsigned int)i);
 }
 )";
 
@@ -131,10 +191,15 @@ kernel void mandelbrot(float xMin, float dx, float yMin, float dy, int xPx, glob
 }
 
 struct ClApp : public SdlGfxApp {
-	ClApp(bool vsync, cl_device_type deviceType) :
-		SdlGfxApp(vsync) {
+	ClApp(bool vsync, cl_device_type deviceType, bool checkerboard, bool dynamicResolution) :
+		SdlGfxApp(vsync),
+		checkerboard(checkerboard),
+		useDynamicResolution(dynamicResolution) {
 		cl_int ec = CL_SUCCESS;
 
+		// The perturbed kernel iterates in float
+		minPixelSize = MIN_PIXEL_SIZE;
+
 		cl_uint platformCount = 0;
 		cl_uint deviceCount = 0;
 
@@ -170,6 +235,14 @@ struct ClApp : public SdlGfxApp {
 		if (ec)
 			goto error;
 
+		perturbedKernel = clCreateKernel(program, "mandelbrot_perturbed", &ec);
+		if (ec)
+			goto error;
+
+		seriesBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY, SeriesApproximation<double>::MAX_TERMS * sizeof(cl_float2), NULL, &ec);
+		if (ec)
+			goto error;
+
 		if (ec = RecreateOutputBuffer())
 			goto error;
 
@@ -185,11 +258,48 @@ struct ClApp : public SdlGfxApp {
 	}
 
 	void Update() override {
+		if (auto nucleus = nucleusSearch.Poll())
+			CentreOn(nucleus->x, nucleus->y);
+
+		// The output is padded from the render size, which is only below the window's while moving
+		SetRenderSize(useDynamicResolution ? dynamicResolution.Scale(IsCameraMoving()) : 1.0);
+		DeepViewport deep = GetDeepViewport();
+		deep.pixelSize = deep.pixelSize * FloatExp((double)clientHeight / renderHeight);
+
+		// The kernels only get a work item for each pixel of the parity
+		int parity = -1;
+		if (checkerboard && IsCameraMoving()) {
+			parity = nextParity;
+			nextParity ^= 1;
+		}
 
-		std::vector<uint8_t> pixels = RunKernel();
+		Stopwatch<> frameTime;
+		std::vector<uint8_t> pixels = RunKernel(deep, parity);
+		if (parity >= 0) {
+			// Different render sizes can pad to the same buffer size, so the last frame is only
+			// reprojected if it was rendered at the same size
+			bool sameSize = presented.size() == pixels.size() && presentedWidth == renderWidth && presentedHeight == renderHeight;
+			Reprojection reprojection;
+			if (sameSize)
+				reprojection = Reprojection::Between(presentedView, deep, renderWidth, renderHeight, calcWidth, calcHeight);
+			Checkerboard::Reconstruct(pixels, calcWidth, calcHeight, parity, sameSize ? presented : std::vector<uint8_t>(), reprojection);
+		}
+		dynamicResolution.Record((double)renderHeight / clientHeight, frameTime.Time<double>());
 		UpdateTexture(pixels);
 		fps++;
 
+		renderStatus.clear();
+		if (renderHeight != clientHeight)
+			renderStatus = " - " + std::to_string(100 * renderHeight / clientHeight) + "% resolution";
+		renderStatus += nucleusSearch.Status();
+
+		if (checkerboard) {
+			presented = pixels;
+			presentedView = deep;
+			presentedWidth = renderWidth;
+			presentedHeight = renderHeight;
+		}
+
 		if (windowResized) {
 			windowResized = false;
 			cl_int ec = CL_SUCCESS;
@@ -202,6 +312,14 @@ struct ClApp : public SdlGfxApp {
 		windowResized = true;
 	}
 
+	// Centres on a nearby minibrot when N is pressed, which is searched for in the background
+	void OnKeyDown(SDL_Scancode code) override {
+		if (code == SDL_Scancode::SDL_SCANCODE_N) {
+			DeepViewport deep = GetDeepViewport();
+			nucleusSearch.Start(deep.xCenter, deep.yCenter, deep.pixelSize * FloatExp(clientHeight) * 0.5, Mandelbrot::MaxIterations(deep.pixelSize));
+		}
+	}
+
 private:
 
 	void Cleanup() {
@@ -211,17 +329,50 @@ private:
 		}
 
 		if (kernel) clReleaseKernel(kernel);
+		if (perturbedKernel) clReleaseKernel(perturbedKernel);
 		if (program) clReleaseProgram(program);
 		if (outBuffer) clReleaseMemObject(outBuffer);
+		if (refBuffer) clReleaseMemObject(refBuffer);
+		if (seriesBuffer) clReleaseMemObject(seriesBuffer);
 		if (commandQueue) clReleaseCommandQueue(commandQueue);
 		if (context) clReleaseContext(context);
 	}
 
-	std::vector<uint8_t> RunKernel() {
+	std::vector<uint8_t> RunKernel(const DeepViewport& deep, int parity) {
 
 		cl_int ec = CL_SUCCESS;
 
 		// Set arguments
+		cl_kernel k = kernel;
+		if (Mandelbrot::NeedsPerturbation(deep.pixelSize)) {
+			SetPerturbedKernelArgs(deep);
+			k = perturbedKernel;
+		} else {
+			SetKernelArgs();
+		}
+		if (ec = clSetKernelArg(k, k == kernel ? 6 : 13, sizeof(int), &parity))
+			ClError(ec);
+
+		// Run kernel. A checkerboard frame only has a work item for every other pixel.
+		size_t globalWorkSize = (size_t)calcWidth * calcHeight;
+		if (parity >= 0)
+			globalWorkSize /= 2;
+		if (ec = clEnqueueNDRangeKernel(commandQueue, k, 1, NULL, &globalWorkSize, &LOCAL_WORK_SIZE, 0, NULL, NULL))
+			ClError(ec);
+		clFlush(commandQueue);
+
+		// Read result
+		std::vector<uint8_t> pxs((size_t)calcWidth * calcHeight * 4);
+		if (ec = clEnqueueReadBuffer(commandQueue, outBuffer, CL_TRUE, 0, pxs.size(), pxs.data(), 0, NULL, NULL))
+			ClError(ec);
+
+		return pxs;
+	}
+
+	void SetKernelArgs() {
+
+		cl_int ec = CL_SUCCESS;
+
 		Viewport vp = GetViewport();
 		float dx = (vp.xMax - vp.xMin) / calcWidth;
 		float dy = (vp.yMax - vp.yMin) / calcHeight;
@@ -237,19 +388,83 @@ private:
 			ClError(ec);
 		if (ec = clSetKernelArg(kernel, 5, sizeof(cl_mem), &outBuffer))
 			ClError(ec);
+	}
 
-		// Run kernel
-		size_t globalWorkSize = (size_t)calcWidth * calcHeight;
-		if (ec = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalWorkSize, &LOCAL_WORK_SIZE, 0, NULL, NULL))
-			ClError(ec);
-		clFlush(commandQueue);
+	void SetPerturbedKernelArgs(const DeepViewport& vp) {
 
-		// Read result
-		std::vector<uint8_t> pxs((size_t)calcWidth * calcHeight * 4);
-		if (ec = clEnqueueReadBuffer(commandQueue, outBuffer, CL_TRUE, 0, pxs.size(), pxs.data(), 0, NULL, NULL))
+		cl_int ec = CL_SUCCESS;
+
+		// The reference orbit and series are computed on the host and only rounded to float for upload.
+		// The orbit is only uploaded again when the cache gives a different one.
+		int maxIter = Mandelbrot::MaxIterations(vp.pixelSize);
+		double pixelSize = (double)vp.pixelSize;
+		double viewDxMin, viewDyMin;
+		auto data = referenceCache.Get(vp.xCenter, vp.yCenter, pixelSize, renderWidth, renderHeight, maxIter, true, viewDxMin, viewDyMin);
+		const ReferenceOrbit& ref = *data->ref;
+		const SeriesApproximation<double>& series = data->series;
+		if (data->ref != uploadedRef) {
+			std::vector<cl_float2> refPoints(ref.z.size());
+			for (size_t i = 0; i < ref.z.size(); i++) {
+				refPoints[i].s[0] = (float)ref.z[i].re;
+				refPoints[i].s[1] = (float)ref.z[i].im;
+			}
+
+			if (refPoints.size() > refBufferCapacity) {
+				if (refBuffer)
+					clReleaseMemObject(refBuffer);
+				refBufferCapacity = refPoints.size();
+				refBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY, refBufferCapacity * sizeof(cl_float2), NULL, &ec);
+				if (ec) {
+					refBufferCapacity = 0;
+					ClError(ec);
+				}
+			}
+			if (ec = clEnqueueWriteBuffer(commandQueue, refBuffer, CL_TRUE, 0, refPoints.size() * sizeof(cl_float2), refPoints.data(), 0, NULL, NULL))
+				ClError(ec);
+			uploadedRef = data->ref;
+		}
+
+		cl_float2 seriesCoeffs[SeriesApproximation<double>::MAX_TERMS]{};
+		for (int k = 0; k < series.terms; k++) {
+			seriesCoeffs[k].s[0] = (float)series.coeffs[k].re;
+			seriesCoeffs[k].s[1] = (float)series.coeffs[k].im;
+		}
+		if (ec = clEnqueueWriteBuffer(commandQueue, seriesBuffer, CL_TRUE, 0, sizeof(seriesCoeffs), seriesCoeffs, 0, NULL, NULL))
 			ClError(ec);
 
-		return pxs;
+		int refLen = ref.Length();
+		float dx = (float)(pixelSize * renderWidth / calcWidth);
+		float dy = (float)(pixelSize * renderHeight / calcHeight);
+		float dxMin = (float)viewDxMin;
+		float dyMin = (float)viewDyMin;
+		if (ec = clSetKernelArg(perturbedKernel, 0, sizeof(cl_mem), &refBuffer))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 1, sizeof(int), &refLen))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 2, sizeof(float), &dxMin))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 3, sizeof(float), &dx))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 4, sizeof(float), &dyMin))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 5, sizeof(float), &dy))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 6, sizeof(int), &calcWidth))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 7, sizeof(int), &maxIter))
+			ClError(ec);
+		int seriesTerms = series.skip ? series.terms : 0;
+		float seriesInvRadius = series.skip ? (float)(1.0 / series.radius) : 0.0f;
+		if (ec = clSetKernelArg(perturbedKernel, 8, sizeof(cl_mem), &seriesBuffer))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 9, sizeof(int), &seriesTerms))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 10, sizeof(int), &series.skip))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 11, sizeof(float), &seriesInvRadius))
+			ClError(ec);
+		if (ec = clSetKernelArg(perturbedKernel, 12, sizeof(cl_mem), &outBuffer))
+			ClError(ec);
 	}
 
 	void UpdateTexture(const std::vector<uint8_t>& pixels) {
@@ -261,45 +476,96 @@ private:
 		SDL_UpdateTexture(tex, nullptr, pixels.data(), 4 * calcWidth);
 	}
 
-	cl_int RecreateOutputBuffer() {
+	// Sets the size of the view in rendered pixels to the window scaled by scale, and the size of
+	// the output to that with padding. The window can grow before its resize event arrives, so the
+	// output buffer is first recreated if a full size frame no longer fits it. A scaled frame can
+	// pad to more than a full size one, and is then rendered at full size instead.
+	void SetRenderSize(double scale) {
+		SizeFrame(1.0);
+		if ((size_t)calcWidth * calcHeight * 4 > outBufSize) {
+			cl_int ec = CL_SUCCESS;
+			if (ec = RecreateOutputBuffer())
+				ClError(ec);
+		}
+
+		SizeFrame(scale);
+		if ((size_t)calcWidth * calcHeight * 4 > outBufSize)
+			SizeFrame(1.0);
+	}
 
-		calcWidth = clientWidth;
-		calcHeight = clientHeight;
+	void SizeFrame(double scale) {
+		renderWidth = std::max(1, (int)std::lround(clientWidth * scale));
+		renderHeight = std::max(1, (int)std::lround(clientHeight * scale));
+		calcWidth = renderWidth;
+		calcHeight = renderHeight;
 
-		// Pad width until (calcWidth * calcHeight) is a multiple of LOCAL_WORK_SIZE
-		while ((size_t)calcWidth * calcHeight % LOCAL_WORK_SIZE)
+		// Pad width until it is even and (calcWidth / 2 * calcHeight) is a multiple of LOCAL_WORK_SIZE,
+		// so that both full and checkerboard frames divide into work groups
+		while (calcWidth % 2 || (size_t)calcWidth / 2 * calcHeight % LOCAL_WORK_SIZE)
 			calcWidth++;
+	}
+
+	cl_int RecreateOutputBuffer() {
+
+		SizeFrame(1.0);
 
 		if (outBuffer)
 			clReleaseMemObject(outBuffer);
 
 		cl_int ec = CL_SUCCESS;
-		size_t outBufSize = (size_t)calcWidth * calcHeight * 4;
+		outBufSize = (size_t)calcWidth * calcHeight * 4;
 		outBuffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, outBufSize, NULL, &ec);
 		return ec;
 	}
 
 	static constexpr size_t LOCAL_WORK_SIZE = 64;
+
+	// Smallest pixel size the float deltas of the perturbed kernel can resolve
+	static constexpr double MIN_PIXEL_SIZE = 1e-36;
+
 	cl_platform_id platform = NULL;
 	cl_device_id device = NULL;
 	cl_context context = NULL;
 	cl_command_queue commandQueue = NULL;
 	cl_program program = NULL;
 	cl_kernel kernel = NULL;
+	cl_kernel perturbedKernel = NULL;
 	cl_mem outBuffer = NULL;
+	cl_mem refBuffer = NULL;
+	cl_mem seriesBuffer = NULL;
+	size_t refBufferCapacity = 0;
+	std::shared_ptr<const ReferenceOrbit> uploadedRef;
+	ReferenceCache referenceCache;
+	size_t outBufSize = 0;
+	int renderWidth = 0;
+	int renderHeight = 0;
 	int calcWidth = 0;
 	int calcHeight = 0;
 	bool windowResized = false;
+
+	const bool checkerboard;
+	const bool useDynamicResolution;
+	DynamicResolution dynamicResolution;
+
+	// The last frame shown, which checkerboard frames are reconstructed from, and its render size
+	std::vector<uint8_t> presented;
+	DeepViewport presentedView;
+	int presentedWidth = 0;
+	int presentedHeight = 0;
+	int nextParity = 0;
+
+	// The search started with N, which the window title shows how it went
+	NucleusSearch nucleusSearch;
 };
 
 struct ClCpuApp : public ClApp {
-	ClCpuApp(bool vsync) :
-		ClApp(vsync, CL_DEVICE_TYPE_CPU) {
+	ClCpuApp(bool vsync, bool checkerboard, bool dynamicResolution) :
+		ClApp(vsync, CL_DEVICE_TYPE_CPU, checkerboard, dynamicResolution) {
 	}
 };
 
 struct ClGpuApp : public ClApp {
-	ClGpuApp(bool vsync) :
-		ClApp(vsync, CL_DEVICE_TYPE_GPU) {
+	ClGpuApp(bool vsync, bool checkerboard, bool dynamicResolution) :
+		ClApp(vsync, CL_DEVICE_TYPE_GPU, checkerboard, dynamicResolution) {
 	}
 };
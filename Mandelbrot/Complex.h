@@ -0,0 +1,61 @@
+#pragma once
+
+template <class T>
+struct ComplexT {
+
+	ComplexT(T re = T(0), T im = T(0)) :
+		re(re),
+		im(im) {
+	}
+
+	template <class U>
+	explicit ComplexT(const ComplexT<U>& other) :
+		re(T(other.re)),
+		im(T(other.im)) {
+	}
+
+	T AbsSquared() const {
+		return re * re + im * im;
+	}
+
+	ComplexT Squared() const {
+		return ComplexT(
+			re * re - im * im,
+			re * im * T(2)
+		);
+	}
+
+	ComplexT operator+(const ComplexT& rhs) const {
+		return ComplexT(
+			re + rhs.re,
+			im + rhs.im
+		);
+	}
+
+	ComplexT operator-(const ComplexT& rhs) const {
+		return ComplexT(
+			re - rhs.re,
+			im - rhs.im
+		);
+	}
+
+	ComplexT operator*(const ComplexT& rhs) const {
+		return ComplexT(
+			re * rhs.re - im * rhs.im,
+			re * rhs.im + im * rhs.re
+		);
+	}
+
+	ComplexT operator*(T rhs) const {
+		return ComplexT(
+			re * rhs,
+			im * rhs
+		);
+	}
+
+	T re;
+	T im;
+};
+
+using Complex = ComplexT<float>;
+using ComplexD = ComplexT<double>;
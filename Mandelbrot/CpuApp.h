@@ -1,99 +1,869 @@
 #pragma once
 #include "SdlApp.h"
 #include "Mandelbrot.h"
+#include "Palette.h"
+#include "ThreadPool.h"
+#include "Antialiasing.h"
+#include "Checkerboard.h"
+#include "DynamicResolution.h"
+#include "Foveation.h"
+#include "Reprojection.h"
+#include "TileCache.h"
+#include "TimeSlicing.h"
+#include "TileQueue.h"
+#include "Presenter.h"
+#include "NucleusFinder.h"
 
 struct CpuApp : public SdlGfxApp {
-	CpuApp(bool vsync, bool sync) :
+
+	struct Options {
+		// Render from the main thread, whole frames a time slice per update so that it keeps up
+		bool sync = false;
+
+		// Rebase deep orbits rather than correcting glitches with extra references
+		bool rebase = true;
+
+		// Fill in pixels far from the set on shallow views
+		bool adaptive = false;
+
+		// Supersample pixels on the boundary between iteration counts
+		bool antialias = false;
+
+		// Average jittered frames while the camera is still
+		bool accumulate = false;
+
+		// Render half the pixels of each frame while the camera moves
+		bool checkerboard = false;
+
+		// Lower the resolution of frames while the camera moves to keep them quick
+		bool dynamicResolution = false;
+
+		// Render in tiles outwards from the cursor, sampling the edges sparsely while the camera moves.
+		// Takes the place of the checkerboard.
+		bool foveated = false;
+
+		// Keep rendered tiles between frames and render tiles ahead of the moving camera with spare
+		// threads. Takes the place of foveation and the checkerboard.
+		bool speculate = false;
+
+		// Render asynchronous whole frames in tiles from the centre out, showing each as it finishes
+		bool progressive = false;
+
+		// Colour asynchronous frames on a stage of their own while the next frame is computed, and
+		// report how many frames a second each stage could keep up with
+		bool pipeline = false;
+	};
+
+	CpuApp(bool vsync, Options options) :
 		SdlGfxApp(vsync),
-		sync(sync) {
+		options(Supported(options)),
+		pool(std::thread::hardware_concurrency()),
+		presenter(ren)
+	{
+		// Frames are rendered at most at the window size, so buffers of that size are set aside up
+		// front and are only grown if the window is
+		size_t pixels = (size_t)clientWidth * clientHeight;
+		for (size_t i = 0; i < COLOUR_BUFFERS; i++)
+			spareColours.emplace_back().reserve(4 * pixels);
+		for (size_t i = 0; i < ITERATION_BUFFERS; i++) {
+			Mandelbrot& m = spareIterations.emplace_back();
+			m.iterCounts.reserve(pixels);
+			m.glitches.reserve(pixels);
+			if (this->options.adaptive)
+				m.distances.reserve(pixels);
+		}
+	}
+
+	~CpuApp() {
+		// The frame in flight could start more speculation, so wait for it first
+		if (mandelbrotTask)
+			mandelbrotTask->Cancel();
+		mandelbrotTask.reset();
+		colourTask.reset();
+		abandonedTasks.clear();
+		tileCache.CancelSpeculation();
 	}
 
 	void Update() override {
+		if (auto nucleus = nucleusSearch.Poll())
+			CentreOn(nucleus->x, nucleus->y);
+
+		// Frames of moving views may be rendered smaller and stretched to the window
+		double scale = options.dynamicResolution ? dynamicResolution.Scale(IsCameraMoving()) : 1.0;
+		renderWidth = std::max(1, (int)std::lround(clientWidth * scale));
+		renderHeight = std::max(1, (int)std::lround(clientHeight * scale));
 
 		Viewport vp = GetViewport();
+		DeepViewport deep = GetDeepViewport();
+		FloatExp resolutionScale = FloatExp((double)clientHeight / renderHeight);
+		deep.pixelSize = deep.pixelSize * resolutionScale;
+
+		// Glitches are only found and corrected across a whole frame, so without rebasing, deep views
+		// can't be rendered a sample, tile or band at a time
+		bool sampled = options.rebase || !Mandelbrot::NeedsPerturbation(deep.pixelSize);
+
+		// With the tile cache, views are snapped to the cache's pixel grid, and zooming views to one of
+		// a few pixel sizes per octave, so that frames share tiles. Render stretches them to the window.
+		std::optional<TileCache::GridView> grid;
+		if (options.speculate && sampled) {
+			if (IsCameraZooming()) {
+				FloatExp quantized = QuantizePixelSize(deep.pixelSize);
+				double ratio = (double)(deep.pixelSize / quantized);
+				renderWidth = std::max(1, (int)std::lround(renderWidth * ratio));
+				renderHeight = std::max(1, (int)std::lround(renderHeight * ratio));
+				deep.pixelSize = quantized;
+			}
+			grid = tileCache.Snap(deep, renderWidth, renderHeight);
+			deep = tileCache.View(*grid);
+			vp = ToViewport(deep, renderWidth, renderHeight);
+		}
+
+		// Moving views are rendered a checkerboard at a time, alternating between frames
+		Sampling sampling;
+		sampling.width = renderWidth;
+		sampling.height = renderHeight;
+		sampling.scale = scale;
+		if (grid && !(options.accumulate && IsAccumulating(deep))) {
+			sampling.cached = true;
+			sampling.grid = *grid;
+			if (auto predicted = PredictGrid(*grid, resolutionScale)) {
+				sampling.speculate = true;
+				sampling.predicted = *predicted;
+			}
+		} else if (options.foveated && sampled) {
+			GetFocus(sampling.xFocus, sampling.yFocus);
+			sampling.xFocus *= (double)renderWidth / clientWidth;
+			sampling.yFocus *= (double)renderHeight / clientHeight;
+			sampling.foveated = true;
+			sampling.reduce = IsCameraMoving();
+		} else if (options.checkerboard && sampled && IsCameraMoving()) {
+			sampling.parity = nextParity;
+		}
+		if (options.progressive && sampled && !options.sync && sampling.IsWhole()) {
+			sampling.progressive = true;
+			sampling.frame = launchedFrame + 1;
+		}
 
-		Mandelbrot result;
+		// Once enough frames of a still view are averaged there is nothing left to improve, and
+		// without averaging a view is only rendered once
+		Request request{ deep, sampling.width, sampling.height, sampling.parity, sampling.reduce };
+		bool converged = options.accumulate
+			? accumulatedFrames >= MAX_ACCUMULATED_FRAMES && IsAccumulating(deep)
+			: IsRequested(request);
+
+		Frame result;
 		bool hasResult = false;
 
-		if (sync) {
-			result = ComputeMandelbrot(vp);
-			hasResult = true;
+		if (options.sync) {
+			if (!converged)
+				hasResult = AdvanceSlice(vp, deep, sampling, request, result);
 		} else {
-			if (!mandelbrotTask)
-				mandelbrotTask = ComputeMandelbrotAsync(vp);
+			// A frame the view has moved too far from to be any use is abandoned, so that the new
+			// view starts straight away. It finishes soon after and is dropped once it has.
+			if (mandelbrotTask && IsStale(launchedView, launchedWidth, launchedHeight)) {
+				mandelbrotTask->Cancel();
+				abandonedTasks.push_back(std::move(*mandelbrotTask));
+				mandelbrotTask.reset();
+			}
+			std::erase_if(abandonedTasks, [this](Task<Frame>& task) {
+				if (!task.IsFinished())
+					return false;
+				RecycleFrame(task.GetResult());
+				return true;
+				});
 
-			if (mandelbrotTask->PollCompletion(result)) {
-				hasResult = true;
+			// In the pipeline the compute stage waits while a computed frame waits for the colour stage
+			if (!mandelbrotTask && !computedFrame && !converged) {
+				mandelbrotTask = options.pipeline
+					? ComputeFrameAsync(vp, deep, sampling, false, {})
+					: ComputeFrameAsync(vp, deep, sampling, true, TakeColourBuffer());
+				launchedFrame++;
+				pendingRequest = request;
+				launchedView = deep;
+				launchedWidth = sampling.width;
+				launchedHeight = sampling.height;
+				nextParity ^= 1;
+			}
+
+			Frame computed;
+			if (mandelbrotTask && mandelbrotTask->PollCompletion(computed)) {
 				mandelbrotTask.reset();
+				computed.request = pendingRequest;
+				if (options.pipeline) {
+					computedFrame = std::move(computed);
+				} else {
+					result = std::move(computed);
+					hasResult = true;
+				}
+			}
+
+			// After polling, so that a finished frame's tiles have all been uploaded
+			UploadFinishedTiles();
+
+			// The colour stage takes the computed frame as soon as it is free, and what it finishes
+			// goes on to the presenter, which uploads it
+			if (colourTask && colourTask->PollCompletion(result)) {
+				colourTask.reset();
+				hasResult = true;
+			}
+			if (computedFrame && !colourTask) {
+				colouringRequest = computedFrame->request;
+				colourTask = ColourFrameAsync(std::move(*computedFrame));
+				computedFrame.reset();
 			}
 		}
 
 		if (hasResult) {
-			UpdateTexture(result);
+			// Pipelined frames come as quickly as the slowest stage, and other frames take both
+			double seconds = options.pipeline
+				? std::max(result.computeSeconds, result.colourSeconds)
+				: result.computeSeconds + result.colourSeconds;
+			dynamicResolution.Record(result.scale, seconds);
+			if (result.parity >= 0)
+				Reconstruct(result);
+			if (options.accumulate)
+				Accumulate(result);
+			Report(result);
+			if (options.checkerboard || options.sync) {
+				presented = result.px;
+				presentedView = result.view;
+			}
+			Show(result);
 			fps++;
+			shownRequest = options.sync ? pendingRequest : result.request;
+			RecycleFrame(std::move(result));
+		}
+
+		// The next update has nothing to do if the view is converged or the frames in flight will
+		// wake the loop when they finish. The update after a frame is shown decides for itself.
+		canSleep = !hasResult && (converged || (!options.sync && (mandelbrotTask || colourTask)));
+		renderStatus = frameStatus + nucleusSearch.Status();
+	}
+
+	// Centres on a nearby minibrot when N is pressed, which is searched for in the background
+	void OnKeyDown(SDL_Scancode code) override {
+		if (code == SDL_Scancode::SDL_SCANCODE_N) {
+			DeepViewport deep = GetDeepViewport();
+			nucleusSearch.Start(deep.xCenter, deep.yCenter, deep.pixelSize * FloatExp(clientHeight) * 0.5, Mandelbrot::MaxIterations(deep.pixelSize), OnFinished{ Wake });
 		}
 	}
 
+	bool CanSleep() const override {
+		return canSleep;
+	}
+
+	// Shows the last finished frame moved and scaled onto the current view, so that the view
+	// responds straight away however long the next frame takes
+	void Render() override {
+		presenter.Present(GetDeepViewport(), clientWidth, clientHeight);
+	}
+
 private:
 
-	Mandelbrot ComputeMandelbrot(Viewport vp) const {
-		return Mandelbrot::ComputeArea(
-			vp.xMin, vp.xMax,
-			vp.yMin, vp.yMax,
-			clientWidth, clientHeight
-		);
+	// Synchronous frames are rendered a time slice at a time on the main thread, so the passes that
+	// would hold it up on the pool for a whole frame are turned off
+	static Options Supported(Options options) {
+		if (options.sync) {
+			options.antialias = false;
+			options.checkerboard = false;
+			options.foveated = false;
+			options.speculate = false;
+		}
+		return options;
+	}
+
+	// What a frame is rendered for, so that a still view isn't rendered again
+	struct Request {
+		DeepViewport view;
+		int width = 0;
+		int height = 0;
+		int parity = -1;
+		bool reduce = false;
+	};
+
+	static bool IsSameRequest(const Request& a, const Request& b) {
+		return IsSameView(a.view, b.view)
+			&& a.width == b.width
+			&& a.height == b.height
+			&& a.parity == b.parity
+			&& a.reduce == b.reduce;
+	}
+
+	// A computed frame and its colours
+	struct Frame {
+		Mandelbrot mandelbrot;
+		std::vector<uint8_t> px;
+		int antialiased = 0;
+
+		// The view the frame was requested for, before any jitter, and the view it was rendered at
+		DeepViewport view;
+		Viewport jitteredVp{};
+		DeepViewport jitteredDeep;
+		Request request;
+
+		// Whether the edges were sampled sparsely, so that antialiasing leaves the frame alone
+		bool reduce = false;
+
+		// The checkerboard parity of the rendered pixels, or -1 if they all were
+		int parity = -1;
+
+		// Number of points sampled, which is less than the number of pixels if some were filled in
+		int samples = 0;
+
+		// The id of the frame if its tiles were streamed as they finished, or 0
+		int64_t streamed = 0;
+
+		// The scale dynamic resolution asked for, which snapping the view can change the size from
+		double scale = 1.0;
+
+		// How long the frame took to compute and to colour, timed by the work itself rather than
+		// from the main loop
+		double computeSeconds = 0.0;
+		double colourSeconds = 0.0;
+	};
+
+	// How the pixels of a frame are picked, for the modes that don't render every pixel of a
+	// whole area at once
+	struct Sampling {
+		int width = 0;
+		int height = 0;
+		double scale = 1.0;
+
+		// Checkerboard parity of the pixels to render, or -1 for all of them
+		int parity = -1;
+
+		// Render in tiles outwards from the focus, and sample the edges sparsely if reduce is set
+		bool foveated = false;
+		bool reduce = false;
+		double xFocus = 0.0;
+		double yFocus = 0.0;
+
+		// Render the grid from the tile cache, then speculatively the predicted grid if speculate is set
+		bool cached = false;
+		bool speculate = false;
+		TileCache::GridView grid;
+		TileCache::GridView predicted;
+
+		// Render in tiles from the centre out and push each to the finished tiles as frame
+		bool progressive = false;
+		int64_t frame = 0;
+
+		bool IsWhole() const {
+			return parity < 0 && !foveated && !cached && !progressive;
+		}
+	};
+
+	// True if the request was shown last, or is the last one on its way through the pipeline
+	bool IsRequested(const Request& request) const {
+		if (computedFrame)
+			return IsSameRequest(computedFrame->request, request);
+		if (colourTask)
+			return IsSameRequest(colouringRequest, request);
+		return shownRequest && IsSameRequest(*shownRequest, request);
+	}
+
+	// Cancelling the task stops the kernels between rows or tiles, and the frame isn't finished but
+	// only hands its buffers back. Unless colour is set the frame is left for the colour stage,
+	// otherwise it is coloured into buffer.
+	Task<Frame> ComputeFrameAsync(Viewport vp, DeepViewport deep, Sampling sampling, bool colour, std::vector<uint8_t> buffer) {
+		Viewport jitteredVp = vp;
+		DeepViewport jitteredDeep = deep;
+		Jitter(jitteredVp, jitteredDeep);
+		CancellationToken cancel;
+		Stopwatch<> computeTime;
+
+		if (!sampling.IsWhole()) {
+			return Task<Frame>(cancel, OnFinished{ Wake }, [=, this, buffer = std::move(buffer), into = TakeIterationBuffer()]() mutable {
+				int samples = 0;
+				Mandelbrot m = ComputeSampled(jitteredVp, jitteredDeep, sampling, samples, cancel, std::move(into));
+				if (cancel.IsCancelled())
+					return Abandoned(std::move(m), std::move(buffer));
+				Frame f = MakeFrame(std::move(m), deep, jitteredVp, jitteredDeep, sampling, samples);
+				f.computeSeconds = computeTime.Time<double>();
+				f.streamed = sampling.progressive ? sampling.frame : 0;
+				if (colour)
+					FinishFrame(f, std::move(buffer));
+				return f;
+				});
+		}
+
+		return Task<Frame>(cancel, OnFinished{ Wake }, [this, deep, jitteredVp, jitteredDeep, sampling, colour, cancel, computeTime, buffer = std::move(buffer), task = ComputeMandelbrotAsync(jitteredVp, jitteredDeep, TakeIterationBuffer(), cancel)]() mutable {
+			Mandelbrot m = task.GetResult();
+			if (cancel.IsCancelled())
+				return Abandoned(std::move(m), std::move(buffer));
+			Frame f = MakeFrame(std::move(m), deep, jitteredVp, jitteredDeep, sampling, sampling.width * sampling.height);
+			f.computeSeconds = computeTime.Time<double>();
+			if (colour)
+				FinishFrame(f, std::move(buffer));
+			return f;
+			});
 	}
 
-	Task<Mandelbrot> ComputeMandelbrotAsync(Viewport vp) const {
+	// The colour stage of the pipeline, which colours a computed frame into a spare buffer
+	Task<Frame> ColourFrameAsync(Frame f) {
+		return Task<Frame>(CancellationToken(), OnFinished{ Wake }, [this, f = std::move(f), buffer = TakeColourBuffer()]() mutable {
+			FinishFrame(f, std::move(buffer));
+			return std::move(f);
+			});
+	}
+
+	// Renders the next time slice of a whole frame of the view. A frame already started carries on
+	// while the camera moves, and is only started over once its view is too far from the current one
+	// to be any use, so that a moving camera still gets frames. Returns true with the frame in f once
+	// it is complete, and until then shows the bands rendered so far over the last frame moved to
+	// the frame's view.
+	bool AdvanceSlice(Viewport vp, DeepViewport deep, const Sampling& sampling, const Request& request, Frame& f) {
+		if (!slice || IsStale(sliceView, sliceSampling.width, sliceSampling.height)) {
+			sliceVp = vp;
+			sliceDeep = deep;
+			Jitter(sliceVp, sliceDeep);
+			slice.emplace(Bands(sliceVp, sliceDeep, sampling.width, sampling.height), TakeIterationBuffer());
+			sliceView = deep;
+			sliceSampling = sampling;
+			pendingRequest = request;
+			nextParity ^= 1;
+		}
+
+		if (slice->Advance(SLICE_BUDGET)) {
+			f = MakeFrame(slice->TakeResult(), sliceView, sliceVp, sliceDeep, sliceSampling, sliceSampling.width * sliceSampling.height);
+			f.computeSeconds = slice->Seconds();
+			FinishFrame(f, TakeColourBuffer());
+			slice.reset();
+			return true;
+		}
+
+		// The partial frame only borrows the slice's size, and is coloured straight from its counts
+		std::vector<Tile> remaining = slice->Remaining();
+		Frame partial;
+		partial.mandelbrot.width = slice->Result().width;
+		partial.mandelbrot.height = slice->Result().height;
+		partial.px = TakeColourBuffer();
+		Palette::Colourize(slice->Result(), partial.px);
+		partial.view = sliceView;
+		FillFromPresented(partial, remaining);
+		Show(partial);
+		RecycleFrame(std::move(partial));
+
+		int pixels = std::max(1, sliceSampling.width * sliceSampling.height);
+		int left = 0;
+		for (const Tile& tile : remaining)
+			left += tile.width * tile.height;
+		frameStatus = " - " + std::to_string(100 - (int)(100ll * left / pixels)) + "% rendered";
+		return false;
+	}
+
+	// Fills the given tiles of a frame with the nearest pixels of the last presented frame moved to
+	// the frame's view, where it covers them
+	void FillFromPresented(Frame& f, const std::vector<Tile>& tiles) const {
+		int width = f.mandelbrot.width;
+		int height = f.mandelbrot.height;
+		if (presented.size() != f.px.size())
+			return;
+		Reprojection reprojection = Reprojection::Between(presentedView, width, height, f.view, width, height);
+		for (const Tile& tile : tiles) {
+			for (int y = tile.y; y < tile.y + tile.height; y++) {
+				for (int x = tile.x; x < tile.x + tile.width; x++) {
+					int ox, oy;
+					if (reprojection.Map(x, y, width, height, ox, oy)) {
+						const uint8_t* old = &presented[4 * ((size_t)oy * width + ox)];
+						std::copy(old, old + 4, &f.px[4 * ((size_t)y * width + x)]);
+					}
+				}
+			}
+		}
+	}
+
+	// Renders the pixels sampling picks one point at a time on the pool
+	Mandelbrot ComputeSampled(Viewport vp, DeepViewport deep, const Sampling& sampling, int& samples, CancellationToken cancel, Mandelbrot into) {
+		Mandelbrot::Sampler sample = Sampler(vp, deep, sampling.width, sampling.height);
+		if (sampling.cached) {
+			int tiles = 0;
+			Mandelbrot m = tileCache.Render(sampling.grid, sample, pool, tiles, cancel, std::move(into));
+			samples = tiles * TileScheduler::TILE_SIZE * TileScheduler::TILE_SIZE;
+			if (sampling.speculate && !cancel.IsCancelled())
+				tileCache.Speculate(sampling.grid, sampling.predicted, sample, pool);
+			return m;
+		}
+		if (sampling.progressive) {
+			samples = sampling.width * sampling.height;
+			return ComputeProgressive(sample, sampling.width, sampling.height, sampling.frame, cancel, std::move(into));
+		}
+		if (sampling.foveated)
+			return Foveation::Compute(sample, sampling.width, sampling.height, sampling.xFocus, sampling.yFocus, sampling.reduce, pool, samples, cancel, std::move(into));
+
+		samples = (sampling.width * sampling.height + 1) / 2;
+		return Checkerboard::Compute(sample, sampling.width, sampling.height, sampling.parity, pool, cancel, std::move(into));
+	}
+
+	// Renders a frame in tiles from the centre out on the pool, and colours and pushes each tile to
+	// the finished tiles as soon as it is rendered
+	Mandelbrot ComputeProgressive(const Mandelbrot::Sampler& sample, int xPx, int yPx, int64_t frame, const CancellationToken& cancel, Mandelbrot into) {
+		Mandelbrot m = Mandelbrot::Blank(xPx, yPx, std::move(into));
+
+		TileScheduler::Run(xPx, yPx, pool, TileScheduler::FromCentre(xPx, yPx), [&](const Tile& tile) {
+			for (int y = tile.y; y < tile.y + tile.height; y++)
+				for (int x = tile.x; x < tile.x + tile.width; x++)
+					m.iterCounts[(size_t)y * xPx + x] = sample(x, y);
+
+			FinishedTile finished;
+			finished.frame = frame;
+			finished.tile = tile;
+			finished.px = Palette::Colourize(m, tile.x, tile.y, tile.width, tile.height);
+			finishedTiles.Push(std::move(finished));
+			Wake();
+			}, cancel);
+		return m;
+	}
+
+	// Passes the finished tiles of the frame in flight on to be streamed, and drops those of frames
+	// that were abandoned
+	void UploadFinishedTiles() {
+		std::vector<FinishedTile> tiles;
+		for (FinishedTile& finished : finishedTiles.Drain())
+			if (finished.frame == launchedFrame)
+				tiles.push_back(std::move(finished));
+		if (!tiles.empty())
+			presenter.StreamTiles(launchedFrame, launchedView, launchedWidth, launchedHeight, tiles);
+	}
+
+	// Renders the same frame as ComputeMandelbrotAsync a band at a time
+	Mandelbrot::Bands Bands(Viewport vp, DeepViewport deep, int width, int height) const {
+		if (Mandelbrot::NeedsPerturbation(deep.pixelSize))
+			return Mandelbrot::PerturbedAreaBands(referenceCache, deep.xCenter, deep.yCenter, deep.pixelSize, width, height, options.rebase);
+		return Mandelbrot::AreaBands(vp.xMin, vp.xMax, vp.yMin, vp.yMax, width, height, options.adaptive);
+	}
+
+	// The frame reuses the memory of into
+	Task<Mandelbrot> ComputeMandelbrotAsync(Viewport vp, DeepViewport deep, Mandelbrot into, CancellationToken cancel) const {
+		if (Mandelbrot::NeedsPerturbation(deep.pixelSize)) {
+			return Mandelbrot::ParallelComputeAreaPerturbedAsync(
+				referenceCache,
+				deep.xCenter, deep.yCenter,
+				deep.pixelSize,
+				renderWidth, renderHeight,
+				options.rebase,
+				std::thread::hardware_concurrency(),
+				std::move(into),
+				cancel
+			);
+		}
+
+		if (options.adaptive) {
+			return Mandelbrot::ParallelComputeAreaAdaptiveAsync(
+				vp.xMin, vp.xMax,
+				vp.yMin, vp.yMax,
+				renderWidth, renderHeight,
+				std::thread::hardware_concurrency(),
+				std::move(into),
+				cancel
+			);
+		}
+
 		return Mandelbrot::ParallelComputeAreaAsync(
 			vp.xMin, vp.xMax,
 			vp.yMin, vp.yMax,
-			clientWidth, clientHeight,
-			std::thread::hardware_concurrency()
+			renderWidth, renderHeight,
+			std::thread::hardware_concurrency(),
+			std::move(into),
+			cancel
 		);
 	}
 
-	// Create an SDL_Texture from a Mandelbrot object
-	void UpdateTexture(const Mandelbrot& m) {
+	// A frame of the iteration counts computed for view at the jittered view, yet to be coloured
+	static Frame MakeFrame(Mandelbrot m, DeepViewport view, Viewport jitteredVp, DeepViewport jitteredDeep, const Sampling& sampling, int samples) {
+		Frame f;
+		f.mandelbrot = std::move(m);
+		f.view = view;
+		f.jitteredVp = jitteredVp;
+		f.jitteredDeep = jitteredDeep;
+		f.parity = sampling.parity;
+		f.reduce = sampling.reduce;
+		f.scale = sampling.scale;
+		f.samples = samples;
+		return f;
+	}
+
+	// Colours a computed frame into buffer, reusing its memory, and antialiases it if enabled.
+	// Frames with pixels that weren't sampled are left alone since their iteration counts aren't real.
+	void FinishFrame(Frame& f, std::vector<uint8_t> buffer) {
+		Stopwatch<> colourTime;
+		const Mandelbrot& m = f.mandelbrot;
+		f.px = std::move(buffer);
+		Palette::Colourize(m, f.px);
+		if (options.antialias && f.parity < 0 && !f.reduce)
+			f.antialiased = Antialiaser::Antialias(m, f.px, Sampler(f.jitteredVp, f.jitteredDeep, m.width, m.height), pool);
+		f.colourSeconds = colourTime.Time<double>();
+	}
+
+	// Colour buffers are passed round the stages and back rather than allocated for every frame.
+	// Only called from the main thread.
+	std::vector<uint8_t> TakeColourBuffer() {
+		if (spareColours.empty())
+			return {};
+		std::vector<uint8_t> buffer = std::move(spareColours.back());
+		spareColours.pop_back();
+		return buffer;
+	}
+
+	void RecycleColourBuffer(std::vector<uint8_t> buffer) {
+		if (spareColours.size() < COLOUR_BUFFERS && buffer.capacity() > 0)
+			spareColours.push_back(std::move(buffer));
+	}
+
+	// Iteration buffers go round in the same way
+	Mandelbrot TakeIterationBuffer() {
+		if (spareIterations.empty())
+			return {};
+		Mandelbrot m = std::move(spareIterations.back());
+		spareIterations.pop_back();
+		return m;
+	}
 
-		if (tex) SDL_DestroyTexture(tex);
+	// Takes back the buffers of a frame that has been shown or thrown away
+	void RecycleFrame(Frame f) {
+		RecycleColourBuffer(std::move(f.px));
+		if (spareIterations.size() < ITERATION_BUFFERS && f.mandelbrot.iterCounts.capacity() > 0)
+			spareIterations.push_back(std::move(f.mandelbrot));
+	}
 
-		std::vector<uint8_t> px(m.width * m.height * 4, 0xFF);
-		for (size_t i = 0; i < px.size(); i += 4) {
-			const Colour& c = PALETTE[m.iterCounts[i / 4] % 16];
-			px[i + 0] = c.r;
-			px[i + 1] = c.g;
-			px[i + 2] = c.b;
+	// A cancelled frame, which only carries its buffers back to be recycled
+	static Frame Abandoned(Mandelbrot m, std::vector<uint8_t> buffer) {
+		Frame f;
+		f.mandelbrot = std::move(m);
+		f.px = std::move(buffer);
+		return f;
+	}
+
+	// Samples the view at any point, at the same precision the whole frame would be rendered at
+	Mandelbrot::Sampler Sampler(Viewport vp, DeepViewport deep, int width, int height) const {
+		if (Mandelbrot::NeedsPerturbation(deep.pixelSize))
+			return Mandelbrot::PerturbedAreaSampler(referenceCache, deep.xCenter, deep.yCenter, deep.pixelSize, width, height, options.rebase);
+		return Mandelbrot::AreaSampler(vp.xMin, vp.xMax, vp.yMin, vp.yMax, width, height);
+	}
+
+	// Fills in the pixels a checkerboard frame didn't render, from the last presented frame
+	// moved to the new view where it agrees with the rendered pixels
+	void Reconstruct(Frame& f) {
+		int width = f.mandelbrot.width;
+		int height = f.mandelbrot.height;
+		Reprojection reprojection;
+		if (presented.size() == f.px.size())
+			reprojection = Reprojection::Between(presentedView, f.view, width, height, width, height);
+		Checkerboard::Reconstruct(f.px, width, height, f.parity, presented, reprojection);
+	}
+
+	// Rounds a pixel size to one of ZOOM_LEVELS_PER_OCTAVE sizes per octave
+	static FloatExp QuantizePixelSize(const FloatExp& pixelSize) {
+		double level = std::round(Log2(pixelSize) * ZOOM_LEVELS_PER_OCTAVE) / ZOOM_LEVELS_PER_OCTAVE;
+		double whole = std::floor(level);
+		return FloatExp(std::exp2(level - whole), (int64_t)whole);
+	}
+
+	static Viewport ToViewport(const DeepViewport& deep, int width, int height) {
+		float x = (float)(double)deep.xCenter;
+		float y = (float)(double)deep.yCenter;
+		float ps = (float)(double)deep.pixelSize;
+		Viewport vp{};
+		vp.xMin = x - width * 0.5f * ps;
+		vp.yMin = y - height * 0.5f * ps;
+		vp.xMax = vp.xMin + width * ps;
+		vp.yMax = vp.yMin + height * ps;
+		return vp;
+	}
+
+	// The grid of the view the camera is predicted to come to rest at, rendered at the same scale as
+	// the frame, or nothing if the frame's sampler can't sample it. Deep samplers only hold
+	// perturbation data for their own pixel size, so deep views are only predicted while panning.
+	std::optional<TileCache::GridView> PredictGrid(const TileCache::GridView& frame, const FloatExp& resolutionScale) {
+		DeepViewport predicted = GetPredictedDeepViewport();
+		FloatExp windowPixelSize = predicted.pixelSize;
+		if (!IsCameraZooming())
+			predicted.pixelSize = frame.pixelSize;
+		else if (Mandelbrot::NeedsPerturbation(frame.pixelSize))
+			return std::nullopt;
+		else
+			predicted.pixelSize = QuantizePixelSize(windowPixelSize * resolutionScale);
+
+		double ratio = (double)(windowPixelSize / predicted.pixelSize);
+		int width = std::max(1, (int)std::lround(clientWidth * ratio));
+		int height = std::max(1, (int)std::lround(clientHeight * ratio));
+		return tileCache.Snap(predicted, width, height);
+	}
+
+	// True if a frame of a width by height view launched earlier would no longer be worth showing,
+	// because it would cover too little of the window or be stretched too far over it
+	bool IsStale(const DeepViewport& launched, int width, int height) const {
+		Reprojection r = Reprojection::Between(launched, width, height, GetDeepViewport(), clientWidth, clientHeight);
+		double stretch = (double)width / (clientWidth * r.scale);
+		return r.Overlap(width, height, clientWidth, clientHeight) < MIN_OVERLAP || stretch > MAX_STRETCH;
+	}
+
+	// True if the accumulated frames are of this view and it is still
+	bool IsAccumulating(const DeepViewport& deep) const {
+		return accumulatedFrames > 0
+			&& !IsCameraMoving()
+			&& accumulatedWidth == clientWidth
+			&& accumulatedHeight == clientHeight
+			&& IsSameView(accumulatedView, deep);
+	}
+
+	static bool IsSameView(const DeepViewport& a, const DeepViewport& b) {
+		return a.xCenter == b.xCenter
+			&& a.yCenter == b.yCenter
+			&& a.pixelSize == b.pixelSize;
+	}
+
+	// Offsets the view of the next accumulated frame within a pixel. Successive frames follow a
+	// Halton sequence so that they cover the pixel evenly. The first frame isn't offset, which is
+	// the first point of the sequence.
+	void Jitter(Viewport& vp, DeepViewport& deep) const {
+		if (!options.accumulate || !IsAccumulating(deep))
+			return;
+
+		// Frames still in the pipeline will be accumulated before this one
+		int index = accumulatedFrames + 1 + (computedFrame ? 1 : 0) + (colourTask ? 1 : 0);
+		double x = Halton(index, 2) - 0.5;
+		double y = Halton(index, 3) - 0.5;
+		float dx = (vp.xMax - vp.xMin) / renderWidth;
+		float dy = (vp.yMax - vp.yMin) / renderHeight;
+		vp.xMin += (float)x * dx;
+		vp.xMax += (float)x * dx;
+		vp.yMin += (float)y * dy;
+		vp.yMax += (float)y * dy;
+		deep.xCenter += Coord(FloatExp(x) * deep.pixelSize);
+		deep.yCenter += Coord(FloatExp(y) * deep.pixelSize);
+	}
+
+	static double Halton(int index, int base) {
+		double f = 1.0;
+		double r = 0.0;
+		for (int i = index; i > 0; i /= base) {
+			f /= base;
+			r += f * (i % base);
 		}
+		return r;
+	}
 
-		tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, m.width, m.height);
+	// Adds a frame to the running average, or starts a new one if the view has changed, and
+	// replaces the frame's colours with the average
+	void Accumulate(Frame& f) {
+		bool sameView = IsAccumulating(f.view) && accumulation.size() == f.px.size();
+		if (!sameView) {
+			accumulation.assign(f.px.size(), 0);
+			accumulatedFrames = 0;
+			accumulatedView = f.view;
+			accumulatedWidth = f.mandelbrot.width;
+			accumulatedHeight = f.mandelbrot.height;
+		}
+
+		accumulatedFrames++;
+		for (size_t i = 0; i < f.px.size(); i++) {
+			accumulation[i] += f.px[i];
+			f.px[i] = (uint8_t)((accumulation[i] + accumulatedFrames / 2) / accumulatedFrames);
+		}
+	}
+
+	// Shows what the optional passes did to the frame in the window title
+	void Report(const Frame& f) {
+		int pixels = std::max(1, f.mandelbrot.width * f.mandelbrot.height);
+		const Mandelbrot::SamplingReport& report = f.mandelbrot.report;
+		frameStatus.clear();
+		if (options.adaptive) {
+			frameStatus += " - " + std::to_string(100 * report.interpolated / pixels) + "% interpolated, "
+				+ std::to_string(report.wrong) + "/" + std::to_string(report.checked) + " sampled wrong";
+		}
+		if (options.antialias)
+			frameStatus += " - " + std::to_string(100 * f.antialiased / pixels) + "% antialiased";
+		if (options.accumulate)
+			frameStatus += " - " + std::to_string(accumulatedFrames) + " frames accumulated";
+		if (f.parity >= 0)
+			frameStatus += " - checkerboard";
+		if (options.foveated || options.speculate)
+			frameStatus += " - " + std::to_string((int)(100ll * f.samples / pixels)) + "% sampled";
+		if (f.mandelbrot.width != clientWidth)
+			frameStatus += " - " + std::to_string(100 * f.mandelbrot.width / clientWidth) + "% resolution";
+		if (options.pipeline) {
+			auto rate = [](double seconds) { return std::to_string((int)std::lround(1.0 / std::max(seconds, 1e-6))) + "/s"; };
+			frameStatus += " - compute " + rate(f.computeSeconds) + ", colour " + rate(f.colourSeconds) + ", upload " + rate(presenter.UploadSeconds());
+		}
+	}
 
-		SDL_UpdateTexture(tex, nullptr, px.data(), 4 * m.width);
+	// Passes a frame on to be presented. Streamed frames that nothing has changed the colours of
+	// since can be shown from the tiles already uploaded.
+	void Show(const Frame& f) {
+		bool unchanged = f.antialiased == 0 && !options.accumulate;
+		presenter.ShowFrame(f.view, f.mandelbrot.width, f.mandelbrot.height, f.px, unchanged ? f.streamed : 0);
 	}
 
-	const bool sync;
-	std::optional<Task<Mandelbrot>> mandelbrotTask;
+	const Options options;
+	mutable ReferenceCache referenceCache;
 
-	struct Colour {
-		uint8_t r, g, b;
-	};
+	// Jobs of the pool use the tile cache and push finished tiles, so both have to outlive the pool
+	TileCache tileCache;
+	TileQueue finishedTiles;
+	ThreadPool pool;
+	std::optional<Task<Frame>> mandelbrotTask;
+	Presenter presenter;
 
-	inline static const Colour PALETTE[16] = {
-		Colour{   0,   0,   0 },
-		Colour{  25,   7,  26 },
-		Colour{   9,   1,  47 },
-		Colour{   4,   4,  73 },
-		Colour{   0,   7, 100 },
-		Colour{  12,  44, 138 },
-		Colour{  24,  82, 177 },
-		Colour{  57, 125, 209 },
-		Colour{ 134, 181, 229 },
-		Colour{ 211, 236, 248 },
-		Colour{ 241, 233, 191 },
-		Colour{ 248, 201,  95 },
-		Colour{ 255, 170,   0 },
-		Colour{ 204, 128,   0 },
-		Colour{ 153,  87,   0 },
-		Colour{ 106,  52,   3 },
-	};
+	// The pipeline's computed frame waiting for the colour stage, the frame being coloured and what it
+	// was requested for, and the colour and iteration buffers not in use. In the pipeline one frame
+	// is computed, one is coloured and one is shown.
+	static constexpr size_t COLOUR_BUFFERS = 3;
+	static constexpr size_t ITERATION_BUFFERS = 3;
+	std::optional<Frame> computedFrame;
+	std::optional<Task<Frame>> colourTask;
+	Request colouringRequest;
+	std::vector<std::vector<uint8_t>> spareColours;
+	std::vector<Mandelbrot> spareIterations;
+
+	// The request of the frame being computed and of the last one shown, and whether the loop can
+	// sleep until the next event
+	Request pendingRequest;
+	std::optional<Request> shownRequest;
+	bool canSleep = false;
+
+	// The view of the frame in flight, and frames that were cancelled but are still stopping
+	static constexpr double MIN_OVERLAP = 0.5;
+	static constexpr double MAX_STRETCH = 2.0;
+	DeepViewport launchedView;
+	int launchedWidth = 0;
+	int launchedHeight = 0;
+	std::vector<Task<Frame>> abandonedTasks;
+
+	// The id of the frame in flight, which progressive tiles are tagged with
+	int64_t launchedFrame = 0;
+
+	static constexpr int ZOOM_LEVELS_PER_OCTAVE = 16;
+
+	// Size of the frame being launched
+	int renderWidth = 0;
+	int renderHeight = 0;
+	DynamicResolution dynamicResolution;
+
+	// Sums of the colours of the frames averaged so far, and the view they are of
+	static constexpr int MAX_ACCUMULATED_FRAMES = 64;
+	std::vector<uint32_t> accumulation;
+	int accumulatedFrames = 0;
+	DeepViewport accumulatedView;
+	int accumulatedWidth = 0;
+	int accumulatedHeight = 0;
+
+	// The frame being rendered a slice at a time in sync mode, its view and sampling, and the view it
+	// is rendered at with any jitter
+	static constexpr double SLICE_BUDGET = 1.0 / 60.0;
+	std::optional<SlicedFrame> slice;
+	DeepViewport sliceView;
+	Sampling sliceSampling;
+	Viewport sliceVp{};
+	DeepViewport sliceDeep;
+
+	// The last frame shown, which checkerboard and sliced frames are filled in from
+	std::vector<uint8_t> presented;
+	DeepViewport presentedView;
+	int nextParity = 0;
+
+	// The search started with N, and the report on the last frame, which the window title shows with
+	// how the search went
+	NucleusSearch nucleusSearch;
+	std::string frameStatus;
 };
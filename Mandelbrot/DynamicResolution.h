@@ -0,0 +1,33 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+
+// Picks the resolution that moving views are rendered at, so that their frames take about
+// TARGET_FRAME_TIME. Render time is taken to be proportional to the number of pixels, which
+// goes with the square of the scale. Still views are always rendered at full resolution.
+struct DynamicResolution {
+
+	static constexpr double TARGET_FRAME_TIME = 1.0 / 30.0;
+	static constexpr double MIN_SCALE = 0.25;
+
+	// Scale of each side of the next frame relative to the window
+	double Scale(bool moving) const {
+		return moving ? scale : 1.0;
+	}
+
+	// Takes into account how long a frame rendered at the given scale took. Full resolution frames
+	// count too, so that the first moving frame already starts at a sensible scale.
+	void Record(double frameScale, double seconds) {
+		if (seconds <= 0.0)
+			return;
+		double ideal = frameScale * std::sqrt(TARGET_FRAME_TIME / seconds);
+
+		// Only move part of the way there, since single frames vary a lot
+		scale = std::clamp(scale + (ideal - scale) * SMOOTHING, MIN_SCALE, 1.0);
+	}
+
+private:
+	static constexpr double SMOOTHING = 0.5;
+
+	double scale = 1.0;
+};
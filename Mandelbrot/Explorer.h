@@ -0,0 +1,141 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "Task.h"
+#include "FloatExp.h"
+#include "BigFixed.h"
+#include "Mandelbrot.h"
+#include "ReferenceCache.h"
+
+// A square view found by the explorer
+struct ExploredView {
+	Coord xCenter;
+	Coord yCenter;
+	FloatExp height;
+	double score = 0.0;
+	int depth = 0;
+};
+
+// Searches for interesting views without rendering full frames. Each region is rendered as a small
+// probe grid, its sub-regions are scored by the entropy of their iteration counts, and the best
+// sub-regions are explored in turn.
+struct Explorer {
+
+	// Width and height of each probe grid in pixels
+	static constexpr int PROBE_SIZE = 32;
+
+	// Each region is split into SUBDIVISIONS x SUBDIVISIONS sub-regions
+	static constexpr int SUBDIVISIONS = 4;
+
+	// Number of sub-regions of each region that are explored further
+	static constexpr int BRANCHING = 2;
+
+	// Explores maxDepth levels down from the square view of the given height centred on
+	// (xCenter, yCenter), and returns every sub-region it chose, best first
+	static std::vector<ExploredView> Explore(const Coord& xCenter, const Coord& yCenter, const FloatExp& height, int maxDepth, int threads) {
+		threads = std::max(1, threads);
+		ExploredView root;
+		root.xCenter = xCenter;
+		root.yCenter = yCenter;
+		root.height = height;
+
+		// Regions of a level are independent, so each level is probed in parallel
+		std::vector<ExploredView> found;
+		std::vector<ExploredView> frontier = { root };
+		for (int depth = 1; depth <= maxDepth && !frontier.empty(); depth++) {
+			std::vector<ExploredView> next;
+			for (size_t first = 0; first < frontier.size(); first += threads) {
+				std::vector<Task<std::vector<ExploredView>>> tasks;
+				for (size_t k = first; k < std::min(frontier.size(), first + threads); k++)
+					tasks.emplace_back(BestSubRegions, frontier[k]);
+				for (auto& task : tasks) {
+					std::vector<ExploredView> best = task.GetResult();
+					next.insert(next.end(), best.begin(), best.end());
+				}
+			}
+			found.insert(found.end(), next.begin(), next.end());
+			frontier = std::move(next);
+		}
+
+		std::stable_sort(found.begin(), found.end(), [](const ExploredView& a, const ExploredView& b) {
+			return a.score > b.score;
+			});
+		return found;
+	}
+
+	static Task<std::vector<ExploredView>> ExploreAsync(const Coord& xCenter, const Coord& yCenter, const FloatExp& height, int maxDepth, int threads) {
+		return Task<std::vector<ExploredView>>([=] {
+			return Explore(xCenter, yCenter, height, maxDepth, threads);
+			});
+	}
+
+private:
+
+	// Probes a region and returns its BRANCHING highest scoring sub-regions
+	static std::vector<ExploredView> BestSubRegions(const ExploredView& region) {
+		Mandelbrot probe = Probe(region);
+
+		constexpr int BLOCK = PROBE_SIZE / SUBDIVISIONS;
+		FloatExp subHeight = region.height / FloatExp(SUBDIVISIONS);
+		std::vector<ExploredView> subRegions;
+		for (int by = 0; by < SUBDIVISIONS; by++) {
+			for (int bx = 0; bx < SUBDIVISIONS; bx++) {
+				ExploredView sub;
+				sub.xCenter = region.xCenter + Coord(subHeight * FloatExp(bx - (SUBDIVISIONS - 1) / 2.0));
+				sub.yCenter = region.yCenter + Coord(subHeight * FloatExp(by - (SUBDIVISIONS - 1) / 2.0));
+				sub.height = subHeight;
+				sub.score = Entropy(probe, bx * BLOCK, by * BLOCK, BLOCK);
+				sub.depth = region.depth + 1;
+				subRegions.push_back(sub);
+			}
+		}
+
+		std::stable_sort(subRegions.begin(), subRegions.end(), [](const ExploredView& a, const ExploredView& b) {
+			return a.score > b.score;
+			});
+
+		// Uniform regions are never worth exploring
+		while (!subRegions.empty() && subRegions.back().score <= 0.0)
+			subRegions.pop_back();
+		if (subRegions.size() > BRANCHING)
+			subRegions.resize(BRANCHING);
+		return subRegions;
+	}
+
+	// Renders the region at probe resolution with the same kernels as the viewer
+	static Mandelbrot Probe(const ExploredView& region) {
+		FloatExp pixelSize = region.height / FloatExp(PROBE_SIZE);
+		if (Mandelbrot::NeedsPerturbation(pixelSize)) {
+			ReferenceCache cache;
+			return Mandelbrot::ComputeAreaPerturbed(cache, region.xCenter, region.yCenter, pixelSize, PROBE_SIZE, PROBE_SIZE, true);
+		}
+
+		float x = (float)(double)region.xCenter;
+		float y = (float)(double)region.yCenter;
+		float h = (float)(double)region.height;
+		return Mandelbrot::ComputeArea(x - h / 2, x + h / 2, y - h / 2, y + h / 2, PROBE_SIZE, PROBE_SIZE);
+	}
+
+	// Shannon entropy in bits of the iteration counts in a size x size block of the probe
+	static double Entropy(const Mandelbrot& probe, int x0, int y0, int size) {
+		std::vector<int> counts;
+		counts.reserve((size_t)size * size);
+		for (int y = y0; y < y0 + size; y++)
+			for (int x = x0; x < x0 + size; x++)
+				counts.push_back(probe.iterCounts[(size_t)y * probe.width + x]);
+		std::sort(counts.begin(), counts.end());
+
+		double entropy = 0.0;
+		double total = (double)counts.size();
+		for (size_t i = 0; i < counts.size();) {
+			size_t j = i;
+			while (j < counts.size() && counts[j] == counts[i])
+				j++;
+			double p = (j - i) / total;
+			entropy -= p * std::log2(p);
+			i = j;
+		}
+		return entropy;
+	}
+};
@@ -0,0 +1,134 @@
+#pragma once
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+
+// A double mantissa with a separate 64 bit exponent, for perturbation deltas smaller than
+// double can represent. The mantissa is kept in [0.5, 1) by every operation.
+// It is several times slower than double so it is only used when the view needs it.
+struct FloatExp {
+
+	FloatExp(double d = 0.0) {
+		int e = 0;
+		mantissa = std::frexp(d, &e);
+		exponent = mantissa == 0.0 ? ZERO_EXPONENT : e;
+	}
+
+	// mantissa * 2^exponent for any finite mantissa
+	FloatExp(double mantissa, int64_t exponent) :
+		FloatExp(mantissa) {
+		if (this->mantissa != 0.0)
+			this->exponent += exponent;
+	}
+
+	explicit operator double() const {
+		return std::ldexp(mantissa, (int)std::clamp<int64_t>(exponent, -2000, 2000));
+	}
+
+	FloatExp operator-() const {
+		return Raw(-mantissa, exponent);
+	}
+
+	FloatExp operator+(const FloatExp& rhs) const {
+		// Anything over 64 binary orders of magnitude smaller is lost in the mantissa anyway
+		int64_t diff = exponent - rhs.exponent;
+		if (diff > 64)
+			return *this;
+		if (diff < -64)
+			return rhs;
+		if (diff >= 0)
+			return FloatExp(mantissa + std::ldexp(rhs.mantissa, -(int)diff), exponent);
+		return FloatExp(std::ldexp(mantissa, (int)diff) + rhs.mantissa, rhs.exponent);
+	}
+
+	FloatExp operator-(const FloatExp& rhs) const {
+		return *this + -rhs;
+	}
+
+	FloatExp operator*(const FloatExp& rhs) const {
+		// The product of two mantissas is in [0.25, 1) so at most one doubling renormalises it
+		double m = mantissa * rhs.mantissa;
+		if (m == 0.0)
+			return FloatExp();
+		int64_t e = exponent + rhs.exponent;
+		if (std::abs(m) < 0.5) {
+			m *= 2.0;
+			e--;
+		}
+		return Raw(m, e);
+	}
+
+	FloatExp operator/(const FloatExp& rhs) const {
+		return FloatExp(mantissa / rhs.mantissa, exponent - rhs.exponent);
+	}
+
+	FloatExp& operator+=(const FloatExp& rhs) { return *this = *this + rhs; }
+	FloatExp& operator-=(const FloatExp& rhs) { return *this = *this - rhs; }
+	FloatExp& operator*=(const FloatExp& rhs) { return *this = *this * rhs; }
+
+	bool operator<(const FloatExp& rhs) const {
+		if ((mantissa < 0.0) != (rhs.mantissa < 0.0))
+			return mantissa < rhs.mantissa;
+		if (exponent != rhs.exponent)
+			return (exponent < rhs.exponent) != (mantissa < 0.0);
+		return mantissa < rhs.mantissa;
+	}
+
+	bool operator>(const FloatExp& rhs) const { return rhs < *this; }
+	bool operator<=(const FloatExp& rhs) const { return !(rhs < *this); }
+	bool operator>=(const FloatExp& rhs) const { return !(*this < rhs); }
+	bool operator==(const FloatExp& rhs) const { return mantissa == rhs.mantissa && exponent == rhs.exponent; }
+	bool operator!=(const FloatExp& rhs) const { return !(*this == rhs); }
+
+	// Zero has the smallest exponent so that adding it to anything is a no-op
+	static constexpr int64_t ZERO_EXPONENT = INT64_MIN / 4;
+
+	double mantissa;
+	int64_t exponent;
+
+private:
+
+	// Skips normalisation for a mantissa that is already in range
+	static FloatExp Raw(double mantissa, int64_t exponent) {
+		FloatExp r;
+		r.mantissa = mantissa;
+		r.exponent = exponent;
+		return r;
+	}
+};
+
+// Overloads that let templates treat double and FloatExp alike. The perturbation templates take
+// the type of the deltas dc and dz from the reference orbit as Real, which is one or the other.
+
+inline double Sqrt(double x) {
+	return std::sqrt(x);
+}
+
+inline FloatExp Sqrt(const FloatExp& x) {
+	// Halve an even exponent so the mantissa's square root stays exact
+	if (x.mantissa == 0.0)
+		return x;
+	int64_t e = x.exponent;
+	double m = x.mantissa;
+	if (e & 1) {
+		m *= 2.0;
+		e--;
+	}
+	return FloatExp(std::sqrt(m), e / 2);
+}
+
+inline double Abs(double x) {
+	return std::abs(x);
+}
+
+inline FloatExp Abs(const FloatExp& x) {
+	return x.mantissa < 0.0 ? -x : x;
+}
+
+inline double Log2(double x) {
+	return std::log2(x);
+}
+
+inline double Log2(const FloatExp& x) {
+	return std::log2(x.mantissa) + (double)x.exponent;
+}
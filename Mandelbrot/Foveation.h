@@ -0,0 +1,65 @@
+#pragma once
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+#include "ThreadPool.h"
+#include "Tiles.h"
+#include "Mandelbrot.h"
+
+// Renders the area around a point of focus at full resolution and samples more sparsely further
+// out. Tiles nearest the focus are scheduled first.
+struct Foveation {
+
+	// Distances from the focus as a fraction of the frame height. Inside FOVEA_RADIUS every pixel is
+	// sampled, and the spacing of samples grows smoothly from there to MAX_STEP at PERIPHERY_RADIUS.
+	static constexpr double FOVEA_RADIUS = 0.15;
+	static constexpr double PERIPHERY_RADIUS = 0.6;
+	static constexpr int MAX_STEP = 4;
+
+	// Renders a frame focused on (xFocus, yFocus) in pixels. Each tile is sampled every Step pixels
+	// and each sample fills its step by step block, unless reduce is false when every pixel of every
+	// tile is sampled. Returns the number of samples taken in samples. The frame reuses the memory
+	// of into.
+	static Mandelbrot Compute(const Mandelbrot::Sampler& sample, int xPx, int yPx, double xFocus, double yFocus, bool reduce, ThreadPool& pool, int& samples, CancellationToken cancel = {}, Mandelbrot into = {}) {
+		Mandelbrot m = Mandelbrot::Blank(xPx, yPx, std::move(into));
+
+		std::atomic<int> taken = 0;
+		auto distance = [&](const Tile& tile) {
+			return Distance(tile, xFocus, yFocus);
+		};
+		TileScheduler::Run(xPx, yPx, pool, distance, [&](const Tile& tile) {
+			int step = reduce ? Step(Distance(tile, xFocus, yFocus) / yPx) : 1;
+			for (int by = tile.y; by < tile.y + tile.height; by += step) {
+				for (int bx = tile.x; bx < tile.x + tile.width; bx += step) {
+					int w = std::min(step, tile.x + tile.width - bx);
+					int h = std::min(step, tile.y + tile.height - by);
+					int iter = sample(bx + (w - 1) * 0.5, by + (h - 1) * 0.5);
+					for (int y = by; y < by + h; y++)
+						std::fill_n(&m.iterCounts[(size_t)y * xPx + bx], w, iter);
+				}
+			}
+			int across = (tile.width + step - 1) / step;
+			int down = (tile.height + step - 1) / step;
+			taken += across * down;
+			}, cancel);
+
+		samples = taken;
+		return m;
+	}
+
+	// Spacing of samples at a distance from the focus, as a fraction of the frame height
+	static int Step(double distance) {
+		double t = std::clamp((distance - FOVEA_RADIUS) / (PERIPHERY_RADIUS - FOVEA_RADIUS), 0.0, 1.0);
+		double smooth = t * t * (3.0 - 2.0 * t);
+		return (int)std::lround(1.0 + (MAX_STEP - 1) * smooth);
+	}
+
+private:
+
+	// Distance from (x, y) to the nearest point of the tile
+	static double Distance(const Tile& tile, double x, double y) {
+		double dx = std::max({ tile.x - x, 0.0, x - (tile.x + tile.width) });
+		double dy = std::max({ tile.y - y, 0.0, y - (tile.y + tile.height) });
+		return std::sqrt(dx * dx + dy * dy);
+	}
+};
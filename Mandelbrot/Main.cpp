@@ -3,10 +3,13 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <fstream>
+#include <thread>
 
 #include "CpuApp.h"
 #include "GpuApp.h"
 #include "ClApp.h"
+#include "Explorer.h"
 
 enum class Backend {
 	Cpu,	// C++
@@ -15,6 +18,9 @@ enum class Backend {
 	ClGpu,	// OpenCL gpu
 };
 
+// Number of levels the explorer descends, each 4x deeper than the last
+constexpr int EXPLORE_DEPTH = 10;
+
 static std::string Lowercase(std::string s) {
 	std::transform(s.begin(), s.end(), s.begin(), std::tolower);
 	return s;
@@ -33,6 +39,21 @@ static std::vector<std::string> SplitString(std::string s, char splitOn = ' ') {
 	return ret;
 }
 
+// Writes the views found by exploring from the whole set to explore.txt, best first
+static void Explore(int depth) {
+	auto views = Explorer::Explore(Coord(-0.5), Coord(0.0), FloatExp(3.0), depth, (int)std::thread::hardware_concurrency());
+
+	std::ofstream file("explore.txt");
+	file << "score depth x y height\n";
+	for (const ExploredView& v : views) {
+		int digits = std::max(4, (int)std::ceil(-std::log10((double)v.height)) + 4);
+		file << v.score << ' ' << v.depth << ' '
+			<< v.xCenter.ToString(digits) << ' '
+			<< v.yCenter.ToString(digits) << ' '
+			<< (double)v.height << '\n';
+	}
+}
+
 int APIENTRY WinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPSTR cmdArgs, _In_ int) {
 
 	auto args = SplitString(Lowercase(cmdArgs));
@@ -40,8 +61,27 @@ int APIENTRY WinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPSTR cmdArgs, _In
 		return std::find(args.begin(), args.end(), arg) != args.end();
 	};
 
-	bool sync = ContainsArg("-sync");
 	bool vsync = ContainsArg("-vsync");
+	bool checkerboard = ContainsArg("-checkerboard");
+	bool dynamicResolution = ContainsArg("-dynres");
+
+	CpuApp::Options cpuOptions;
+	cpuOptions.sync = ContainsArg("-sync");
+	cpuOptions.rebase = !ContainsArg("-norebase");
+	cpuOptions.adaptive = ContainsArg("-adaptive");
+	cpuOptions.antialias = ContainsArg("-aa");
+	cpuOptions.accumulate = ContainsArg("-accumulate");
+	cpuOptions.checkerboard = checkerboard;
+	cpuOptions.dynamicResolution = dynamicResolution;
+	cpuOptions.foveated = ContainsArg("-foveated");
+	cpuOptions.speculate = ContainsArg("-speculate");
+	cpuOptions.progressive = ContainsArg("-progressive");
+	cpuOptions.pipeline = ContainsArg("-pipeline");
+
+	if (ContainsArg("-explore")) {
+		Explore(EXPLORE_DEPTH);
+		return 0;
+	}
 
 	Backend backend;
 	if (ContainsArg("-cpu"))		backend = Backend::Cpu;
@@ -52,10 +92,10 @@ int APIENTRY WinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPSTR cmdArgs, _In
 	try {
 		std::unique_ptr<Application> app;
 		switch (backend) {
-		case Backend::Cpu:		app = std::make_unique<CpuApp>(vsync, sync);	break;
+		case Backend::Cpu:		app = std::make_unique<CpuApp>(vsync, cpuOptions);	break;
 		case Backend::Gpu:		app = std::make_unique<GpuApp>(vsync);			break;
-		case Backend::ClCpu:	app = std::make_unique<ClCpuApp>(vsync);		break;
-		case Backend::ClGpu:	app = std::make_unique<ClGpuApp>(vsync);		break;
+		case Backend::ClCpu:	app = std::make_unique<ClCpuApp>(vsync, checkerboard, dynamicResolution);	break;
+		case Backend::ClGpu:	app = std::make_unique<ClGpuApp>(vsync, checkerboard, dynamicResolution);	break;
 		}
 		app->Run();
 	} catch (std::runtime_error& err) {
@@ -1,99 +1,607 @@
 #pragma once
 #include <vector>
+#include <memory>
+#include <functional>
+#include <cmath>
+#include <algorithm>
 #include "Task.h"
+#include "Complex.h"
+#include "Perturbation.h"
+#include "ReferenceCache.h"
 
-struct Complex {
-
-	Complex(float re = 0.0f, float im = 0.0f) :
-		re(re),
-		im(im) {
-	}
+struct Mandelbrot {
 
-	float AbsSquared() const {
-		return re * re + im * im;
+	static int ComputePoint(float x, float y, int maxIter = 100) {
+		Complex z;
+		Complex c(x, y);
+		for (int i = 0; i < maxIter; i++) {
+			z = z.Squared() + c;
+			if (z.AbsSquared() > 4.0f)
+				return i;
+		}
+		return maxIter;
 	}
 
-	Complex Squared() const {
-		return Complex(
-			re * re - im * im,
-			re * im * 2
-		);
+	// A frame of xPx by yPx iteration counts of 0, reusing the memory of into, so that frames can be
+	// rendered into buffers recycled from earlier frames
+	static Mandelbrot Blank(int xPx, int yPx, Mandelbrot into) {
+		into.iterCounts.assign((size_t)xPx * yPx, 0);
+		into.glitches.clear();
+		into.distances.clear();
+		into.report = SamplingReport();
+		into.width = xPx;
+		into.height = yPx;
+		return into;
 	}
 
-	Complex operator+(const Complex& rhs) const {
-		return Complex(
-			re + rhs.re,
-			im + rhs.im
-		);
+	// The kernels check cancel between rows and leave the rest of the area 0 once it is cancelled
+	static Mandelbrot ComputeArea(float xMin, float xMax, float yMin, float yMax, int xPx, int yPx, CancellationToken cancel = {}) {
+		Mandelbrot r = Blank(xPx, yPx, {});
+		ComputeRows(r, xMin, (xMax - xMin) / xPx, yMin, (yMax - yMin) / yPx, 0, yPx, cancel);
+		return r;
 	}
 
-	float re;
-	float im;
-};
-
+	// The threads render bands of rows straight into the frame, which reuses the memory of into
+	static Task<Mandelbrot> ParallelComputeAreaAsync(float xMin, float xMax, float yMin, float yMax, int xPx, int yPx, int threads, Mandelbrot into, CancellationToken cancel = {}) {
+		return Task<Mandelbrot>(cancel, [=, into = std::move(into)]() mutable {
+			float dx = (xMax - xMin) / xPx;
+			float dy = (yMax - yMin) / yPx;
+			Mandelbrot v = Blank(xPx, yPx, std::move(into));
 
-struct Mandelbrot {
+			std::vector<Task<int>> tasks;
+			for (int i = 0; i < threads; i++) {
+				int rowMin = yPx * i / threads;
+				int rowMax = yPx * (i + 1) / threads;
+				if (rowMax > rowMin)
+					tasks.emplace_back([&, rowMin, rowMax] { return ComputeRows(v, xMin, dx, yMin, dy, rowMin, rowMax - rowMin, cancel); });
+			}
+			for (auto& task : tasks)
+				task.GetResult();
+			return v;
+			});
+	}
 
-	static int ComputePoint(float x, float y, int maxIter = 100) {
+	// Like ComputePoint, and also sets distance to an estimate of the distance from (x, y) to the set,
+	// found from the derivative dz/dc. It is 0 for points that don't escape, or whose derivative overflows.
+	static int ComputePointDistance(float x, float y, float& distance, int maxIter = 100) {
 		Complex z;
+		Complex dz;
 		Complex c(x, y);
 		for (int i = 0; i < maxIter; i++) {
+			dz = z * dz * 2.0f + Complex(1.0f);
 			z = z.Squared() + c;
-			if (z.AbsSquared() > 4.0f)
+			if (z.AbsSquared() > 4.0f) {
+				float r = std::sqrt(z.AbsSquared());
+				distance = 0.5f * r * std::log(r) / std::sqrt(dz.AbsSquared());
 				return i;
+			}
+		}
+		distance = 0.0f;
+		return maxIter;
+	}
+
+	// Evaluates every ADAPTIVE_STEP-th pixel in each direction, then fills in each block between
+	// them whose corners escape at the same iteration and are all further from the set than the
+	// block's diagonal. Other blocks are evaluated fully. Every ADAPTIVE_CHECK_STRIDE-th filled in
+	// pixel is evaluated anyway to measure the error, which is reported in the result.
+	static Mandelbrot ComputeAreaAdaptive(float xMin, float xMax, float yMin, float yMax, int xPx, int yPx, CancellationToken cancel = {}) {
+		Mandelbrot r = Blank(xPx, yPx, {});
+		r.distances.assign((size_t)xPx * yPx, 0.0f);
+		r.report = ComputeRowsAdaptive(r, xMin, (xMax - xMin) / xPx, yMin, (yMax - yMin) / yPx, 0, yPx, cancel);
+		return r;
+	}
+
+	// Like ParallelComputeAreaAsync. The blocks are laid out within each thread's band.
+	static Task<Mandelbrot> ParallelComputeAreaAdaptiveAsync(float xMin, float xMax, float yMin, float yMax, int xPx, int yPx, int threads, Mandelbrot into, CancellationToken cancel = {}) {
+		return Task<Mandelbrot>(cancel, [=, into = std::move(into)]() mutable {
+			float dx = (xMax - xMin) / xPx;
+			float dy = (yMax - yMin) / yPx;
+			Mandelbrot v = Blank(xPx, yPx, std::move(into));
+			v.distances.assign((size_t)xPx * yPx, 0.0f);
+
+			// With fewer rows than threads, some threads get none
+			std::vector<Task<SamplingReport>> tasks;
+			for (int i = 0; i < threads; i++) {
+				int rowMin = yPx * i / threads;
+				int rowMax = yPx * (i + 1) / threads;
+				if (rowMax > rowMin)
+					tasks.emplace_back([&, rowMin, rowMax] { return ComputeRowsAdaptive(v, xMin, dx, yMin, dy, rowMin, rowMax - rowMin, cancel); });
+			}
+			for (auto& task : tasks) {
+				SamplingReport r = task.GetResult();
+				v.report.interpolated += r.interpolated;
+				v.report.checked += r.checked;
+				v.report.wrong += r.wrong;
+			}
+			return v;
+			});
+	}
+
+	// Below this pixel size, float no longer resolves neighbouring pixels and the
+	// view has to be rendered by perturbation
+	static bool NeedsPerturbation(const FloatExp& pixelSize) {
+		return pixelSize < FloatExp(1e-6);
+	}
+
+	// Deep views need more iterations before detail becomes visible
+	static int MaxIterations(const FloatExp& pixelSize) {
+		double depth = std::log2(1e-6) - Log2(pixelSize);
+		return std::max(100, 100 + (int)(30.0 * depth));
+	}
+
+	// Iterates dz, the difference between the orbit of (ref.c + dc) and the reference orbit.
+	// Since dz and dc are tiny, this only needs hardware precision however deep the view is.
+	// If glitched is given, iteration stops early and sets it when dz loses too much precision.
+	template <class Real>
+	static int ComputePointPerturbed(const PerturbationData<Real>& data, ComplexT<Real> dc, int maxIter, bool* glitched = nullptr) {
+		using ComplexR = ComplexT<Real>;
+		const ReferenceOrbit& ref = *data.ref;
+
+		// Every pixel of the view shares the first iterations through the series approximation.
+		// i counts the iterations done so far and n is the matching reference iteration.
+		ComplexR dz = data.series.Evaluate(dc);
+		int i = data.series.skip;
+		int n = i;
+		while (i < maxIter) {
+
+			// Skip as many iterations as the bilinear approximation allows, else do one
+			if (const BlaStep<Real>* step = data.bla.Lookup(n, dz.AbsSquared(), maxIter - i)) {
+				dz = step->a * dz + step->b * dc;
+				n += step->l;
+				i += step->l;
+			} else {
+				dz = ComplexR(ref.z[n] * 2.0) * dz + dz.Squared() + dc;
+				n++;
+				i++;
+			}
+
+			// z itself is always within double's range
+			ComplexR z = ComplexR(ref.z[n]) + dz;
+			ComplexD zd(z);
+			if (zd.AbsSquared() > 4.0)
+				return i - 1;
+
+			if (data.rebase) {
+				// Once z is nearer zero than dz, or the reference has escaped, continue from the
+				// start of the reference orbit with dz = z. dz then stays small relative to z and
+				// the pixel can never glitch.
+				if (z.AbsSquared() < dz.AbsSquared() || n == ref.Length()) {
+					dz = z;
+					n = 0;
+				}
+				continue;
+			}
+
+			if (glitched && zd.AbsSquared() < GLITCH_TOLERANCE * GLITCH_TOLERANCE * ref.z[n].AbsSquared()) {
+				*glitched = true;
+				return i - 1;
+			}
+
+			if (n == ref.Length()) {
+				// The reference escaped first, so finish this orbit directly
+				ComplexD c = ref.c + ComplexD(dc);
+				for (; i < maxIter; i++) {
+					zd = zd.Squared() + c;
+					if (zd.AbsSquared() > 4.0)
+						return i;
+				}
+				return maxIter;
+			}
 		}
 		return maxIter;
 	}
 
-	static Mandelbrot ComputeArea(float xMin, float xMax, float yMin, float yMax, int xPx, int yPx) {
+	// dxMin and dyMin are the offsets of the top left pixel from the reference point
+	template <class Real>
+	static Mandelbrot ComputeAreaPerturbed(const PerturbationData<Real>& data, Real dxMin, Real dyMin, Real pixelSize, int xPx, int yPx, int maxIter, CancellationToken cancel = {}) {
+		Mandelbrot r = Blank(xPx, yPx, {});
+		r.glitches.assign((size_t)xPx * yPx, 0);
+		ComputeRowsPerturbed(r, data, dxMin, dyMin, pixelSize, 0, yPx, maxIter, cancel);
+		return r;
+	}
+
+	// Renders a view centred on (xCenter, yCenter) using a reference orbit from the cache, which is
+	// computed at the centre unless an earlier one is still usable.
+	// Without rebasing, glitched pixels are instead corrected with extra reference orbits.
+	static Mandelbrot ComputeAreaPerturbed(ReferenceCache& cache, const Coord& xCenter, const Coord& yCenter, FloatExp pixelSize, int xPx, int yPx, bool rebase, CancellationToken cancel = {}) {
+		return WithDeltaType(pixelSize, [&](auto tag) {
+			using Real = decltype(tag);
+			Real ps = (Real)pixelSize;
+			int maxIter = MaxIterations(pixelSize);
+			Real dxMin, dyMin;
+			auto data = cache.Get(xCenter, yCenter, ps, xPx, yPx, maxIter, rebase, dxMin, dyMin);
+
+			Mandelbrot r = ComputeAreaPerturbed(*data, dxMin, dyMin, ps, xPx, yPx, maxIter, cancel);
+			if (!cancel.IsCancelled())
+				CorrectGlitches(r, *data->ref, dxMin, dyMin, ps, maxIter, 1);
+			return r;
+			});
+	}
+
+	// The cache must outlive the task
+	static Task<Mandelbrot> ParallelComputeAreaPerturbedAsync(ReferenceCache& cache, const Coord& xCenter, const Coord& yCenter, FloatExp pixelSize, int xPx, int yPx, bool rebase, int threads, Mandelbrot into, CancellationToken cancel = {}) {
+		return Task<Mandelbrot>(cancel, [=, &cache, into = std::move(into)]() mutable {
+			return WithDeltaType(pixelSize, [&](auto tag) {
+				using Real = decltype(tag);
+				return ParallelComputeAreaPerturbed(cache, xCenter, yCenter, (Real)pixelSize, xPx, yPx, rebase, threads, cancel, std::move(into));
+				});
+			});
+	}
+
+	// Returns the iteration count at a point of a view in pixel coordinates, where the pixels of the
+	// area functions are at whole coordinates. Used to take extra samples of a frame.
+	using Sampler = std::function<int(double x, double y)>;
+
+	static Sampler AreaSampler(float xMin, float xMax, float yMin, float yMax, int xPx, int yPx) {
+		float dx = (xMax - xMin) / xPx;
+		float dy = (yMax - yMin) / yPx;
+		return [=](double x, double y) {
+			return ComputePoint(xMin + dx * (float)x, yMin + dy * (float)y);
+		};
+	}
+
+	// Samples the view rendered by ComputeAreaPerturbed with the same arguments, reusing its reference
+	static Sampler PerturbedAreaSampler(ReferenceCache& cache, const Coord& xCenter, const Coord& yCenter, FloatExp pixelSize, int xPx, int yPx, bool rebase) {
+		return WithDeltaType(pixelSize, [&](auto tag) -> Sampler {
+			using Real = decltype(tag);
+			Real ps = (Real)pixelSize;
+			int maxIter = MaxIterations(pixelSize);
+			Real dxMin, dyMin;
+			auto data = cache.Get(xCenter, yCenter, ps, xPx, yPx, maxIter, rebase, dxMin, dyMin);
+			return [=](double x, double y) {
+				ComplexT<Real> dc(dxMin + ps * Real(x), dyMin + ps * Real(y));
+				return ComputePointPerturbed(*data, dc, maxIter);
+			};
+			});
+	}
+
+	// Renders a view a band of rows at a time on the calling thread, for frames spread over several
+	// calls. Start returns a blank frame of the view reusing the memory of into, Render renders rows
+	// rowMin to rowMin + rows of it with the same kernel as the whole area functions, and Finish does
+	// what they do to the whole frame once every row is in.
+	struct Bands {
+		std::function<Mandelbrot(Mandelbrot into)> Start;
+		std::function<void(Mandelbrot& m, int rowMin, int rows)> Render;
+		std::function<void(Mandelbrot& m)> Finish;
+	};
+
+	static Bands AreaBands(float xMin, float xMax, float yMin, float yMax, int xPx, int yPx, bool adaptive) {
 		float dx = (xMax - xMin) / xPx;
 		float dy = (yMax - yMin) / yPx;
-		std::vector<int> v;
-		v.reserve((size_t)xPx * yPx);
+		Bands bands;
+		bands.Start = [=](Mandelbrot into) {
+			Mandelbrot m = Blank(xPx, yPx, std::move(into));
+			if (adaptive)
+				m.distances.assign((size_t)xPx * yPx, 0.0f);
+			return m;
+		};
+		bands.Render = [=](Mandelbrot& m, int rowMin, int rows) {
+			if (!adaptive) {
+				ComputeRows(m, xMin, dx, yMin, dy, rowMin, rows, {});
+				return;
+			}
+			SamplingReport r = ComputeRowsAdaptive(m, xMin, dx, yMin, dy, rowMin, rows, {});
+			m.report.interpolated += r.interpolated;
+			m.report.checked += r.checked;
+			m.report.wrong += r.wrong;
+		};
+		bands.Finish = [](Mandelbrot&) {};
+		return bands;
+	}
+
+	// The cache must outlive the bands
+	static Bands PerturbedAreaBands(ReferenceCache& cache, const Coord& xCenter, const Coord& yCenter, FloatExp pixelSize, int xPx, int yPx, bool rebase) {
+		return WithDeltaType(pixelSize, [&](auto tag) {
+			using Real = decltype(tag);
+			Real ps = (Real)pixelSize;
+			int maxIter = MaxIterations(pixelSize);
+			Real dxMin, dyMin;
+			auto data = cache.Get(xCenter, yCenter, ps, xPx, yPx, maxIter, rebase, dxMin, dyMin);
+
+			Bands bands;
+			bands.Start = [=](Mandelbrot into) {
+				Mandelbrot m = Blank(xPx, yPx, std::move(into));
+				m.glitches.assign((size_t)xPx * yPx, 0);
+				return m;
+			};
+			bands.Render = [=](Mandelbrot& m, int rowMin, int rows) {
+				ComputeRowsPerturbed(m, *data, dxMin, dyMin, ps, rowMin, rows, maxIter, {});
+			};
+			bands.Finish = [=](Mandelbrot& m) {
+				CorrectGlitches(m, *data->ref, dxMin, dyMin, ps, maxIter, 1);
+			};
+			return bands;
+			});
+	}
+
+	// Recomputes glitched pixels against a new reference inside each connected cluster of them.
+	// Pixels that are still glitched are clustered again on the next pass.
+	template <class Real>
+	static void CorrectGlitches(Mandelbrot& m, const ReferenceOrbit& primary, Real dxMin, Real dyMin, Real pixelSize, int maxIter, int threads) {
+		for (int pass = 0; pass < MAX_GLITCH_PASSES; pass++) {
+			std::vector<std::vector<int>> clusters = FindGlitchClusters(m);
+			if (clusters.empty())
+				return;
+
+			// Clusters cover disjoint pixels, so they can be corrected in parallel
+			std::vector<Task<int>> tasks;
+			for (int t = 0; t < threads; t++) {
+				tasks.emplace_back([&, t] {
+					int fixed = 0;
+					for (size_t k = t; k < clusters.size(); k += threads)
+						fixed += CorrectGlitchCluster(m, clusters[k], primary, dxMin, dyMin, pixelSize, maxIter);
+					return fixed;
+					});
+			}
+			for (auto& task : tasks)
+				task.GetResult();
+		}
+	}
+
+	std::vector<int> iterCounts;
+
+	// Non-zero for pixels whose perturbed orbit lost precision. Only filled by the perturbed functions.
+	std::vector<uint8_t> glitches;
+
+	// Estimated distance from each pixel to the set. Only filled by the adaptive functions.
+	std::vector<float> distances;
+
+	// How many pixels the adaptive functions filled in rather than evaluated, and how many of a
+	// sample of those were wrong
+	struct SamplingReport {
+		int interpolated = 0;
+		int checked = 0;
+		int wrong = 0;
+	} report;
+
+	int width = 0;
+	int height = 0;
+
+private:
+
+	template <class Real>
+	static Mandelbrot ParallelComputeAreaPerturbed(ReferenceCache& cache, const Coord& xCenter, const Coord& yCenter, Real pixelSize, int xPx, int yPx, bool rebase, int threads, CancellationToken cancel, Mandelbrot into) {
+		int maxIter = MaxIterations(FloatExp(pixelSize));
+		Real dxMin, dyMin;
+		auto data = cache.Get(xCenter, yCenter, pixelSize, xPx, yPx, maxIter, rebase, dxMin, dyMin);
+
+		Mandelbrot v = Blank(xPx, yPx, std::move(into));
+		v.glitches.assign((size_t)xPx * yPx, 0);
+
+		// The perturbation data is shared read only between the threads
+		std::vector<Task<int>> tasks;
+		for (int i = 0; i < threads; i++) {
+			int rowMin = yPx * i / threads;
+			int rowMax = yPx * (i + 1) / threads;
+			if (rowMax > rowMin)
+				tasks.emplace_back([&, rowMin, rowMax] { return ComputeRowsPerturbed(v, *data, dxMin, dyMin, pixelSize, rowMin, rowMax - rowMin, maxIter, cancel); });
+		}
+		for (auto& task : tasks)
+			task.GetResult();
 
-		float fy = yMin;
-		for (int y = 0; y < yPx; y++) {
+		if (!cancel.IsCancelled())
+			CorrectGlitches(v, *data->ref, dxMin, dyMin, pixelSize, maxIter, threads);
+		return v;
+	}
+
+	// The row kernels render rows rowMin to rowMin + rows of a blank frame m in place, which
+	// several threads can do at once for different rows. (xMin, yMin) or (dxMin, dyMin) is the top
+	// left pixel of the whole frame. They return the number of rows rendered before cancel was set.
+	static int ComputeRows(Mandelbrot& m, float xMin, float dx, float yMin, float dy, int rowMin, int rows, const CancellationToken& cancel) {
+		for (int y = rowMin; y < rowMin + rows; y++) {
+			if (cancel.IsCancelled())
+				return y - rowMin;
+			float fy = yMin + dy * y;
 			float fx = xMin;
-			for (int x = 0; x < xPx; x++) {
-				v.push_back(ComputePoint(fx, fy));
+			int* out = &m.iterCounts[(size_t)y * m.width];
+			for (int x = 0; x < m.width; x++) {
+				out[x] = ComputePoint(fx, fy);
 				fx += dx;
 			}
-			fy += dy;
 		}
+		return rows;
+	}
 
-		Mandelbrot r;
-		r.iterCounts = std::move(v);
-		r.width = xPx;
-		r.height = yPx;
-		return r;
+	template <class Real>
+	static int ComputeRowsPerturbed(Mandelbrot& m, const PerturbationData<Real>& data, Real dxMin, Real dyMin, Real pixelSize, int rowMin, int rows, int maxIter, const CancellationToken& cancel) {
+		for (int y = rowMin; y < rowMin + rows; y++) {
+			if (cancel.IsCancelled())
+				return y - rowMin;
+			Real dy = dyMin + pixelSize * Real(y);
+			size_t row = (size_t)y * m.width;
+			for (int x = 0; x < m.width; x++) {
+				Real dx = dxMin + pixelSize * Real(x);
+				bool glitched = false;
+				m.iterCounts[row + x] = ComputePointPerturbed(data, ComplexT<Real>(dx, dy), maxIter, &glitched);
+				m.glitches[row + x] = glitched;
+			}
+		}
+		return rows;
 	}
 
-	static Task<Mandelbrot> ParallelComputeAreaAsync(float xMin, float xMax, float yMin, float yMax, int xPx, int yPx, int threads) {
-		return Task<Mandelbrot>([=] {
-			int rowsPerThread = yPx / threads;
-			float heightPerThread = (yMax - yMin) / threads;
+	// The adaptive grid is laid out within the band of rows. m must have distances, and the report
+	// of the band is returned rather than added to m's, which other bands may be writing.
+	static SamplingReport ComputeRowsAdaptive(Mandelbrot& m, float xMin, float dx, float yMin, float dy, int rowMin, int rows, const CancellationToken& cancel) {
+		int xPx = m.width;
+		SamplingReport report;
+		if (xPx <= 0 || rows <= 0)
+			return report;
 
-			std::vector<Task<Mandelbrot>> tasks;
-			for (int i = 0; i < threads; i++) {
-				float min = yMin + heightPerThread * i;
-				float max = min + heightPerThread;
-				tasks.emplace_back(ComputeArea, xMin, xMax, min, max, xPx, rowsPerThread);
+		// y is relative to the band from here on
+		int* counts = &m.iterCounts[(size_t)rowMin * xPx];
+		float* distances = &m.distances[(size_t)rowMin * xPx];
+		float yBand = yMin + dy * rowMin;
+		std::fill_n(counts, (size_t)xPx * rows, -1);
+		auto evaluate = [&](int x, int y) {
+			size_t k = (size_t)y * xPx + x;
+			if (counts[k] < 0)
+				counts[k] = ComputePointDistance(xMin + dx * x, yBand + dy * y, distances[k]);
+		};
+
+		// Grid lines, including the last row and column
+		std::vector<int> xs;
+		std::vector<int> ys;
+		for (int x = 0; x < xPx; x += ADAPTIVE_STEP)
+			xs.push_back(x);
+		for (int y = 0; y < rows; y += ADAPTIVE_STEP)
+			ys.push_back(y);
+		if (xs.back() != xPx - 1)
+			xs.push_back(xPx - 1);
+		if (ys.back() != rows - 1)
+			ys.push_back(rows - 1);
+		for (int y : ys) {
+			if (cancel.IsCancelled())
+				break;
+			for (int x : xs)
+				evaluate(x, y);
+		}
+
+		float diagonal = std::sqrt(dx * dx + dy * dy) * ADAPTIVE_STEP;
+		int sinceCheck = 0;
+		for (size_t j = 0; j + 1 < ys.size() && !cancel.IsCancelled(); j++) {
+			for (size_t i = 0; i + 1 < xs.size(); i++) {
+				int x0 = xs[i], x1 = xs[i + 1];
+				int y0 = ys[j], y1 = ys[j + 1];
+				size_t corners[4] = {
+					(size_t)y0 * xPx + x0, (size_t)y0 * xPx + x1,
+					(size_t)y1 * xPx + x0, (size_t)y1 * xPx + x1,
+				};
+
+				int iter = counts[corners[0]];
+				float distance = distances[corners[0]];
+				bool far = true;
+				for (size_t k : corners) {
+					far &= counts[k] == iter && distances[k] > diagonal;
+					distance = std::min(distance, distances[k]);
+				}
+
+				for (int y = y0; y <= y1; y++) {
+					for (int x = x0; x <= x1; x++) {
+						size_t k = (size_t)y * xPx + x;
+						if (!far) {
+							evaluate(x, y);
+						} else if (counts[k] < 0) {
+							counts[k] = iter;
+							distances[k] = distance;
+							report.interpolated++;
+							if (++sinceCheck == ADAPTIVE_CHECK_STRIDE) {
+								sinceCheck = 0;
+								float unused;
+								report.checked++;
+								report.wrong += ComputePointDistance(xMin + dx * x, yBand + dy * y, unused) != iter;
+							}
+						}
+					}
+				}
 			}
+		}
 
-			Mandelbrot v;
-			v.iterCounts.reserve((size_t)xPx * yPx);
-			for (auto& task : tasks) {
-				std::vector<int> r = std::move(task.GetResult().iterCounts);
-				v.iterCounts.insert(v.iterCounts.end(), r.begin(), r.end());
+		// Pixels left unevaluated by cancelling are still marked -1
+		if (cancel.IsCancelled())
+			std::replace(counts, counts + (size_t)xPx * rows, -1, 0);
+		return report;
+	}
+
+	// Spacing of the grid that adaptive sampling evaluates first, in pixels
+	static constexpr int ADAPTIVE_STEP = 4;
+	static constexpr int ADAPTIVE_CHECK_STRIDE = 64;
+
+	// A pixel is glitched once |z| drops far below |Z|, since dz then holds all of z
+	// but only has precision relative to the reference
+	static constexpr double GLITCH_TOLERANCE = 1e-3;
+	static constexpr int MAX_GLITCH_PASSES = 4;
+	static constexpr size_t MAX_GLITCH_CLUSTERS = 64;
+
+	// Returns the 4-connected clusters of glitched pixels, largest first
+	static std::vector<std::vector<int>> FindGlitchClusters(const Mandelbrot& m) {
+		std::vector<std::vector<int>> clusters;
+		std::vector<uint8_t> visited(m.glitches.size());
+		std::vector<int> stack;
+		for (int start = 0; start < (int)m.glitches.size(); start++) {
+			if (!m.glitches[start] || visited[start])
+				continue;
+
+			std::vector<int> cluster;
+			visited[start] = true;
+			stack.push_back(start);
+			while (!stack.empty()) {
+				int k = stack.back();
+				stack.pop_back();
+				cluster.push_back(k);
+
+				int x = k % m.width;
+				int y = k / m.width;
+				int neighbours[4] = {
+					x > 0 ? k - 1 : -1,
+					x < m.width - 1 ? k + 1 : -1,
+					y > 0 ? k - m.width : -1,
+					y < m.height - 1 ? k + m.width : -1,
+				};
+				for (int nb : neighbours) {
+					if (nb >= 0 && m.glitches[nb] && !visited[nb]) {
+						visited[nb] = true;
+						stack.push_back(nb);
+					}
+				}
 			}
+			clusters.push_back(std::move(cluster));
+		}
 
-			v.width = xPx;
-			v.height = yPx;
-			return v;
+		// Leave the smallest clusters for later passes if there are too many for one
+		std::sort(clusters.begin(), clusters.end(), [](const auto& a, const auto& b) {
+			return a.size() > b.size();
 			});
+		if (clusters.size() > MAX_GLITCH_CLUSTERS)
+			clusters.resize(MAX_GLITCH_CLUSTERS);
+		return clusters;
 	}
 
-	std::vector<int> iterCounts;
-	int width = 0;
-	int height = 0;
+	// Recomputes a cluster against a reference at its pixel nearest the centroid, which is
+	// never glitched itself. Returns the number of pixels that are no longer glitched.
+	template <class Real>
+	static int CorrectGlitchCluster(Mandelbrot& m, const std::vector<int>& cluster, const ReferenceOrbit& primary, Real dxMin, Real dyMin, Real pixelSize, int maxIter) {
+		int xMin = m.width, yMin = m.height, xMax = 0, yMax = 0;
+		double xSum = 0.0, ySum = 0.0;
+		for (int k : cluster) {
+			int x = k % m.width;
+			int y = k / m.width;
+			xMin = std::min(xMin, x);
+			yMin = std::min(yMin, y);
+			xMax = std::max(xMax, x);
+			yMax = std::max(yMax, y);
+			xSum += x;
+			ySum += y;
+		}
+
+		double xMean = xSum / cluster.size();
+		double yMean = ySum / cluster.size();
+		int refIndex = *std::min_element(cluster.begin(), cluster.end(), [&](int a, int b) {
+			double ax = a % m.width - xMean, ay = a / m.width - yMean;
+			double bx = b % m.width - xMean, by = b / m.width - yMean;
+			return ax * ax + ay * ay < bx * bx + by * by;
+			});
+		int rx = refIndex % m.width;
+		int ry = refIndex / m.width;
+
+		auto data = PerturbationData<Real>::Compute(
+			primary.cx + Coord(FloatExp(dxMin + pixelSize * Real(rx))),
+			primary.cy + Coord(FloatExp(dyMin + pixelSize * Real(ry))),
+			pixelSize,
+			pixelSize * Real(xMin - rx), pixelSize * Real(yMin - ry),
+			pixelSize * Real(xMax - rx), pixelSize * Real(yMax - ry),
+			maxIter,
+			false
+		);
+
+		int fixed = 0;
+		for (int k : cluster) {
+			int x = k % m.width;
+			int y = k / m.width;
+			bool glitched = false;
+			m.iterCounts[k] = ComputePointPerturbed(*data, ComplexT<Real>(pixelSize * Real(x - rx), pixelSize * Real(y - ry)), maxIter, &glitched);
+			m.glitches[k] = glitched;
+			fixed += !glitched;
+		}
+		return fixed;
+	}
 };
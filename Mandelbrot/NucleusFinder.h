@@ -0,0 +1,174 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include "Task.h"
+#include "Complex.h"
+#include "FloatExp.h"
+#include "BigFixed.h"
+#include "ReferenceOrbit.h"
+
+// The centre of a minibrot, where z_period = 0
+struct Nucleus {
+	Coord x;
+	Coord y;
+	int period = 0;
+
+	// Estimated radius of the minibrot
+	FloatExp size;
+};
+
+// Locates nuclei near a point, by finding the lowest period within a radius of it and then
+// solving z_period(c) = 0 with Newton's method
+struct NucleusFinder {
+
+	// Newton stops once its step is this small relative to the size of the minibrot
+	static constexpr double CONVERGENCE = 0x1p-32;
+	static constexpr int MAX_NEWTON_STEPS = 64;
+	static constexpr double MAX_WANDER = 1024.0;
+
+	// Returns a nucleus of the lowest period found within radius of (cx, cy), or nothing if no period
+	// up to maxPeriod is found or Newton's method doesn't converge. The nucleus Newton converges to
+	// can be a few radii away.
+	static std::optional<Nucleus> Find(const Coord& cx, const Coord& cy, const FloatExp& radius, int maxPeriod) {
+		int period = FindPeriod(cx, cy, radius, maxPeriod);
+		if (period == 0)
+			return std::nullopt;
+
+		Nucleus n;
+		n.x = cx;
+		n.y = cy;
+		n.period = period;
+
+		// Each step roughly squares the error, so the precision doubles as the steps shrink
+		int bits = PrecisionBits(radius);
+		for (int k = 0; k < MAX_NEWTON_STEPS; k++) {
+			ComplexF step;
+			ComplexF size;
+			bool bounded = WithPrecision(bits, [&](auto tag) {
+				return NewtonStep<decltype(tag)>(n.x, n.y, period, step, size);
+				});
+			if (!bounded)
+				return std::nullopt;
+
+			n.x -= Coord(step.re);
+			n.y -= Coord(step.im);
+			n.size = Sqrt(size.AbsSquared());
+
+			// The first steps often overshoot by a few radii before converging, but this far out
+			// Newton has wandered off somewhere unrelated
+			if (Abs(FloatExp(n.x - cx)) > radius * MAX_WANDER || Abs(FloatExp(n.y - cy)) > radius * MAX_WANDER)
+				return std::nullopt;
+
+			FloatExp stepSize = Sqrt(step.AbsSquared());
+			if (stepSize <= n.size * CONVERGENCE)
+				return n;
+			bits = std::max(bits, (int)std::ceil(-2.0 * Log2(stepSize)) + 64);
+		}
+		return std::nullopt;
+	}
+
+	static Task<std::optional<Nucleus>> FindAsync(const Coord& cx, const Coord& cy, const FloatExp& radius, int maxPeriod, OnFinished onFinished = {}) {
+		return Task<std::optional<Nucleus>>(CancellationToken(), std::move(onFinished), [=] {
+			return Find(cx, cy, radius, maxPeriod);
+			});
+	}
+
+	// Returns the lowest period p at which the image of the disc of the given radius around c
+	// contains zero, or 0 if there is none up to maxPeriod. The image of the disc is bounded by
+	// a disc around z_n with radius r_{n+1} = 2 |z_n| r_n + r_n^2 + radius.
+	static int FindPeriod(const Coord& cx, const Coord& cy, const FloatExp& radius, int maxPeriod) {
+		ReferenceOrbit ref = ReferenceOrbit::Compute(cx, cy, radius, maxPeriod);
+		FloatExp r;
+		for (int p = 1; p <= ref.Length(); p++) {
+			FloatExp z = std::sqrt(ref.z[p - 1].AbsSquared());
+			r = z * r * 2.0 + r * r + radius;
+			if (FloatExp(std::sqrt(ref.z[p].AbsSquared())) < r)
+				return p;
+		}
+		return 0;
+	}
+
+private:
+
+	using ComplexF = ComplexT<FloatExp>;
+
+	// Iterates z_period(c) and its derivative at the precision of Real, and sets step to the Newton
+	// step and size to the size estimate of the minibrot at c. Returns false if the orbit escapes.
+	template <class Real>
+	static bool NewtonStep(const Coord& cx, const Coord& cy, int period, ComplexF& step, ComplexF& size) {
+		Real x;
+		Real y;
+		Real cxr(cx);
+		Real cyr(cy);
+
+		// dzdc is the derivative with respect to c. l is the derivative with respect to z_1, from which
+		// the size estimate 1 / (b l^2) with b = sum 1 / l_i is found.
+		ComplexF dzdc;
+		ComplexF l(1.0);
+		ComplexF b(1.0);
+		for (int i = 1; i <= period; i++) {
+			ComplexF z((FloatExp)x, (FloatExp)y);
+			dzdc = z * dzdc * 2.0 + ComplexF(1.0);
+
+			Real xx = x.Squared();
+			Real yy = y.Squared();
+			y = (x + y).Squared() - xx - yy + cyr;
+			x = xx - yy + cxr;
+
+			ComplexD zd((double)x, (double)y);
+			if (zd.AbsSquared() > 4.0)
+				return false;
+			if (i < period) {
+				l = ComplexF(zd) * l * 2.0;
+				b = b + Reciprocal(l);
+			}
+		}
+
+		ComplexF z((FloatExp)x, (FloatExp)y);
+		step = z * Reciprocal(dzdc);
+		size = Reciprocal(b * l * l);
+		return true;
+	}
+
+	static ComplexF Reciprocal(const ComplexF& a) {
+		FloatExp d = FloatExp(1.0) / a.AbsSquared();
+		return ComplexF(a.re * d, -a.im * d);
+	}
+};
+
+// A search for a nucleus in the background, one at a time, and a line on how the last one went for
+// the window title
+struct NucleusSearch {
+
+	// Starts searching within radius of (cx, cy), unless a search is already running
+	void Start(const Coord& cx, const Coord& cy, const FloatExp& radius, int maxPeriod, OnFinished onFinished = {}) {
+		if (task)
+			return;
+		task = NucleusFinder::FindAsync(cx, cy, radius, maxPeriod, std::move(onFinished));
+		status = " - searching for minibrot";
+	}
+
+	// Returns the nucleus once the search finds one
+	std::optional<Nucleus> Poll() {
+		std::optional<Nucleus> nucleus;
+		if (!task || !task->PollCompletion(nucleus))
+			return std::nullopt;
+
+		task.reset();
+		if (nucleus)
+			status = " - period " + std::to_string(nucleus->period) + " minibrot of size 2^" + std::to_string((int)Log2(nucleus->size));
+		else
+			status = " - no minibrot found";
+		return nucleus;
+	}
+
+	const std::string& Status() const {
+		return status;
+	}
+
+private:
+	std::optional<Task<std::optional<Nucleus>>> task;
+	std::string status;
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "Mandelbrot.h"
+
+// The colours of the CPU backend, cycled through by iteration count
+struct Palette {
+
+	struct Colour {
+		uint8_t r, g, b;
+	};
+
+	static const Colour& Lookup(int iterCount) {
+		return COLOURS[iterCount % 16];
+	}
+
+	// Returns the RGBA32 pixels of m
+	static std::vector<uint8_t> Colourize(const Mandelbrot& m) {
+		std::vector<uint8_t> px;
+		Colourize(m, px);
+		return px;
+	}
+
+	// Writes the RGBA32 pixels of m to px, reusing its memory
+	static void Colourize(const Mandelbrot& m, std::vector<uint8_t>& px) {
+		px.resize((size_t)m.width * m.height * 4);
+		for (size_t i = 0; i < px.size(); i += 4) {
+			const Colour& c = Lookup(m.iterCounts[i / 4]);
+			px[i + 0] = c.r;
+			px[i + 1] = c.g;
+			px[i + 2] = c.b;
+			px[i + 3] = 0xFF;
+		}
+	}
+
+	// Returns the RGBA32 pixels of the width by height rectangle of m at (x, y)
+	static std::vector<uint8_t> Colourize(const Mandelbrot& m, int x, int y, int width, int height) {
+		std::vector<uint8_t> px((size_t)width * height * 4, 0xFF);
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				const Colour& c = Lookup(m.iterCounts[(size_t)(y + j) * m.width + x + i]);
+				uint8_t* p = &px[4 * ((size_t)j * width + i)];
+				p[0] = c.r;
+				p[1] = c.g;
+				p[2] = c.b;
+			}
+		}
+		return px;
+	}
+
+private:
+
+	inline static const Colour COLOURS[16] = {
+		Colour{   0,   0,   0 },
+		Colour{  25,   7,  26 },
+		Colour{   9,   1,  47 },
+		Colour{   4,   4,  73 },
+		Colour{   0,   7, 100 },
+		Colour{  12,  44, 138 },
+		Colour{  24,  82, 177 },
+		Colour{  57, 125, 209 },
+		Colour{ 134, 181, 229 },
+		Colour{ 211, 236, 248 },
+		Colour{ 241, 233, 191 },
+		Colour{ 248, 201,  95 },
+		Colour{ 255, 170,   0 },
+		Colour{ 204, 128,   0 },
+		Colour{ 153,  87,   0 },
+		Colour{ 106,  52,   3 },
+	};
+};
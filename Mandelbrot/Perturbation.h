@@ -0,0 +1,102 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "FloatExp.h"
+#include "BigFixed.h"
+#include "ReferenceOrbit.h"
+#include "SeriesApproximation.h"
+#include "BlaTable.h"
+
+// Everything derived from a reference orbit that the pixels of a view read while iterating.
+// It is built once per frame and then shared read only between threads.
+template <class Real>
+struct PerturbationData {
+	using ComplexR = ComplexT<Real>;
+
+	// Builds the data for pixels spanning the offsets [dxMin, dxMax] x [dyMin, dyMax] from (cx, cy)
+	static std::shared_ptr<const PerturbationData> Compute(const Coord& cx, const Coord& cy, Real pixelSize, Real dxMin, Real dyMin, Real dxMax, Real dyMax, int maxIter, bool rebase) {
+		auto ref = std::make_shared<const ReferenceOrbit>(ReferenceOrbit::Compute(cx, cy, FloatExp(pixelSize), maxIter));
+		return Compute(ref, dxMin, dyMin, dxMax, dyMax, maxIter, rebase);
+	}
+
+	// Builds the data for a view of xPx by yPx pixels centred on (cx, cy)
+	static std::shared_ptr<const PerturbationData> Compute(const Coord& cx, const Coord& cy, Real pixelSize, int xPx, int yPx, int maxIter, bool rebase) {
+		Real w = pixelSize * Real(xPx * 0.5);
+		Real h = pixelSize * Real(yPx * 0.5);
+		return Compute(cx, cy, pixelSize, -w, -h, w, h, maxIter, rebase);
+	}
+
+	// Builds the data for pixels spanning the offsets [dxMin, dxMax] x [dyMin, dyMax] from an
+	// existing reference. Tables of previous are reused if they are still valid for this area.
+	static std::shared_ptr<const PerturbationData> Compute(std::shared_ptr<const ReferenceOrbit> ref, Real dxMin, Real dyMin, Real dxMax, Real dyMax, int maxIter, bool rebase, const PerturbationData* previous = nullptr) {
+		auto data = std::make_shared<PerturbationData>();
+		data->ref = std::move(ref);
+		data->rebase = rebase;
+		data->dxMin = dxMin;
+		data->dyMin = dyMin;
+		data->dxMax = dxMax;
+		data->dyMax = dyMax;
+		data->maxIter = maxIter;
+		if (previous && previous->ref != data->ref)
+			previous = nullptr;
+
+		// The series is only checked at the probes, so it is reused for exactly the same area
+		if (previous && previous->maxIter == maxIter &&
+			previous->dxMin == dxMin && previous->dyMin == dyMin &&
+			previous->dxMax == dxMax && previous->dyMax == dyMax) {
+			data->series = previous->series;
+		} else {
+			// Probe the corners and edge midpoints of the area
+			Real dxMid = (dxMin + dxMax) * Real(0.5);
+			Real dyMid = (dyMin + dyMax) * Real(0.5);
+			std::vector<ComplexR> probes = {
+				{ dxMin, dyMin }, { dxMid, dyMin }, { dxMax, dyMin },
+				{ dxMin, dyMid },                   { dxMax, dyMid },
+				{ dxMin, dyMax }, { dxMid, dyMax }, { dxMax, dyMax },
+			};
+			data->series = SeriesApproximation<Real>::Compute(*data->ref, probes, maxIter);
+		}
+
+		// Radii built for a larger dcMax are conservative, so the table is reused while it is
+		// not too much larger than needed
+		Real dxFar = std::max(Abs(dxMin), Abs(dxMax));
+		Real dyFar = std::max(Abs(dyMin), Abs(dyMax));
+		data->dcMax = Sqrt(ComplexR(dxFar, dyFar).AbsSquared());
+		if (previous && data->dcMax <= previous->dcMax && data->dcMax * Real(2.0) > previous->dcMax) {
+			data->dcMax = previous->dcMax;
+			data->bla = previous->bla;
+		} else {
+			data->bla = BlaTable<Real>::Compute(*data->ref, data->dcMax);
+		}
+		return data;
+	}
+
+	std::shared_ptr<const ReferenceOrbit> ref;
+	SeriesApproximation<Real> series;
+	BlaTable<Real> bla;
+
+	// The area and iteration count the data was built for
+	Real dxMin = 0.0;
+	Real dyMin = 0.0;
+	Real dxMax = 0.0;
+	Real dyMax = 0.0;
+	Real dcMax = 0.0;
+	int maxIter = 0;
+
+	// Whether pixels rebase onto the start of the reference orbit instead of glitching
+	bool rebase = true;
+};
+
+// Below this pixel size, squares of deltas underflow double and they are held as FloatExp
+constexpr double FLOATEXP_PIXEL_SIZE = 1e-140;
+
+// Calls fn with a default constructed double, or FloatExp if the view is too deep for double
+// deltas, so that the perturbation code can be instantiated for the cheapest type that works
+template <class Fn>
+auto WithDeltaType(const FloatExp& pixelSize, Fn&& fn) {
+	if (pixelSize < FloatExp(FLOATEXP_PIXEL_SIZE))
+		return fn(FloatExp());
+	return fn(0.0);
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "SDL.h"
+#include "Stopwatch.h"
+#include "Application.h"
+#include "Reprojection.h"
+#include "Tiles.h"
+#include "TileQueue.h"
+
+// Uploads frames to textures and presents them moved onto the current view. The SDL renderer can
+// only be used from the main thread, so everything here happens on the main thread, and frames and
+// tiles are uploaded as they are shown.
+struct Presenter {
+
+	Presenter(SDL_Renderer* ren) :
+		ren(ren)
+	{
+	}
+
+	Presenter(const Presenter&) = delete;
+	Presenter& operator=(const Presenter&) = delete;
+
+	~Presenter() {
+		if (tex) SDL_DestroyTexture(tex);
+		if (streamTex) SDL_DestroyTexture(streamTex);
+	}
+
+	// Shows a width by height frame of a view. If streamed is the id of a frame whose tiles were all
+	// streamed and px are still their colours, the streaming texture is shown instead of uploading px.
+	void ShowFrame(const DeepViewport& view, int width, int height, const std::vector<uint8_t>& px, int64_t streamed = 0) {
+		ApplyFrame(view, width, height, px.data(), streamed);
+	}
+
+	// Uploads finished tiles of a width by height frame of a view, which are drawn over the last frame
+	// shown until a frame replaces it
+	void StreamTiles(int64_t frame, const DeepViewport& view, int width, int height, const std::vector<FinishedTile>& tiles) {
+		Stream(frame, view, width, height, tiles);
+	}
+
+	// How long the last frame took to upload
+	double UploadSeconds() const {
+		return uploadSeconds;
+	}
+
+	// Presents what has been shown moved onto the current view of the window
+	void Present(const DeepViewport& view, int clientWidth, int clientHeight) {
+		Draw(view, clientWidth, clientHeight);
+	}
+
+private:
+
+	void ApplyFrame(const DeepViewport& view, int width, int height, const uint8_t* px, int64_t streamed) {
+		Stopwatch<> upload;
+		if (streamed != 0 && streamed == streamFrame && streamedTiles.size() == TileScheduler::Split(width, height).size()) {
+			std::swap(tex, streamTex);
+		} else {
+			// The texture is only recreated when the frame size changes
+			int w = 0, h = 0;
+			if (tex)
+				SDL_QueryTexture(tex, nullptr, nullptr, &w, &h);
+			if (!tex || w != width || h != height) {
+				if (tex) SDL_DestroyTexture(tex);
+				tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, width, height);
+			}
+			SDL_UpdateTexture(tex, nullptr, px, 4 * width);
+		}
+		texView = view;
+		texWidth = width;
+		texHeight = height;
+		streamedTiles.clear();
+		streamFrame = 0;
+		uploadSeconds = upload.Time<double>();
+	}
+
+	// Uploads only the tiles' rectangles to the streaming texture, starting it over for a new frame
+	void Stream(int64_t frame, const DeepViewport& view, int width, int height, const std::vector<FinishedTile>& tiles) {
+		if (streamFrame != frame) {
+			int access = 0, w = 0, h = 0;
+			if (streamTex)
+				SDL_QueryTexture(streamTex, nullptr, &access, &w, &h);
+			if (!streamTex || access != SDL_TEXTUREACCESS_STREAMING || w != width || h != height) {
+				if (streamTex) SDL_DestroyTexture(streamTex);
+				streamTex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, width, height);
+			}
+			streamFrame = frame;
+			streamView = view;
+			streamWidth = width;
+			streamHeight = height;
+			streamedTiles.clear();
+		}
+
+		for (const FinishedTile& finished : tiles) {
+			const Tile& tile = finished.tile;
+			SDL_Rect rect{ tile.x, tile.y, tile.width, tile.height };
+			SDL_UpdateTexture(streamTex, &rect, finished.px.data(), 4 * tile.width);
+			streamedTiles.push_back(tile);
+		}
+	}
+
+	// The renderer does the resampling onto the current view
+	void Draw(const DeepViewport& view, int clientWidth, int clientHeight) {
+		SDL_RenderClear(ren);
+		if (tex) {
+			Reprojection r = Reprojection::Between(texView, texWidth, texHeight, view, clientWidth, clientHeight);
+			SDL_FRect dst{};
+			dst.x = (float)(-r.xOffset / r.scale);
+			dst.y = (float)(-r.yOffset / r.scale);
+			dst.w = (float)(texWidth / r.scale);
+			dst.h = (float)(texHeight / r.scale);
+			SDL_RenderCopyF(ren, tex, nullptr, &dst);
+		}
+
+		// Tiles of the frame in flight go over it as they finish
+		if (streamTex && !streamedTiles.empty()) {
+			Reprojection r = Reprojection::Between(streamView, streamWidth, streamHeight, view, clientWidth, clientHeight);
+			for (const Tile& tile : streamedTiles) {
+				SDL_Rect src{ tile.x, tile.y, tile.width, tile.height };
+				SDL_FRect dst{};
+				dst.x = (float)((tile.x - r.xOffset) / r.scale);
+				dst.y = (float)((tile.y - r.yOffset) / r.scale);
+				dst.w = (float)(tile.width / r.scale);
+				dst.h = (float)(tile.height / r.scale);
+				SDL_RenderCopyF(ren, streamTex, &src, &dst);
+			}
+		}
+		SDL_RenderPresent(ren);
+	}
+
+	SDL_Renderer* ren;
+
+	SDL_Texture* tex = nullptr;
+	DeepViewport texView;
+	int texWidth = 0;
+	int texHeight = 0;
+	SDL_Texture* streamTex = nullptr;
+	int64_t streamFrame = 0;
+	DeepViewport streamView;
+	int streamWidth = 0;
+	int streamHeight = 0;
+	std::vector<Tile> streamedTiles;
+	double uploadSeconds = 0.0;
+};
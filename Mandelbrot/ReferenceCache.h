@@ -0,0 +1,55 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include "FloatExp.h"
+#include "BigFixed.h"
+#include "ReferenceOrbit.h"
+#include "Perturbation.h"
+
+// Keeps the last reference orbit and the tables derived from it, so that the frames of a moving
+// or zooming view don't each recompute a bignum orbit. The orbit is reused while it lies inside
+// the view and has enough precision, and is extended when the view needs more iterations.
+struct ReferenceCache {
+
+	// Returns the data for a view of xPx by yPx pixels centred on (cx, cy), and sets dxMin and
+	// dyMin to the offset of its top left pixel from the reference, which need not be the centre
+	template <class Real>
+	std::shared_ptr<const PerturbationData<Real>> Get(const Coord& cx, const Coord& cy, Real pixelSize, int xPx, int yPx, int maxIter, bool rebase, Real& dxMin, Real& dyMin) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		Real w = pixelSize * Real(xPx * 0.5);
+		Real h = pixelSize * Real(yPx * 0.5);
+		bool reusable = orbit && orbit->bits >= PrecisionBits(FloatExp(pixelSize));
+		if (reusable) {
+			reusable = Abs(Real(FloatExp(cx - orbit->cx))) <= w &&
+				Abs(Real(FloatExp(cy - orbit->cy))) <= h;
+		}
+
+		if (!reusable) {
+			orbit = std::make_shared<const ReferenceOrbit>(ReferenceOrbit::Compute(cx, cy, FloatExp(pixelSize), maxIter));
+		} else if (orbit->Length() < maxIter && !orbit->Escaped()) {
+			// The old orbit may still be in use, so extend a copy of it
+			auto extended = std::make_shared<ReferenceOrbit>(*orbit);
+			extended->Extend(maxIter);
+			orbit = std::move(extended);
+		}
+
+		Real xOffset = Real(FloatExp(cx - orbit->cx));
+		Real yOffset = Real(FloatExp(cy - orbit->cy));
+		dxMin = xOffset - w;
+		dyMin = yOffset - h;
+
+		auto& data = std::get<std::shared_ptr<const PerturbationData<Real>>>(cached);
+		data = PerturbationData<Real>::Compute(orbit, dxMin, dyMin, xOffset + w, yOffset + h, maxIter, rebase, data.get());
+		return data;
+	}
+
+private:
+	std::mutex mutex;
+	std::shared_ptr<const ReferenceOrbit> orbit;
+	std::tuple<
+		std::shared_ptr<const PerturbationData<double>>,
+		std::shared_ptr<const PerturbationData<FloatExp>>
+	> cached;
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include "Complex.h"
+#include "FloatExp.h"
+#include "BigFixed.h"
+
+// The orbit of a single point c, iterated at high precision and stored rounded to double.
+// Nearby points are then iterated as small perturbations from this orbit.
+struct ReferenceOrbit {
+
+	// Computes the orbit of (cx, cy) with enough precision to resolve pixelSize
+	static ReferenceOrbit Compute(const Coord& cx, const Coord& cy, const FloatExp& pixelSize, int maxIter) {
+		ReferenceOrbit r;
+		r.cx = cx;
+		r.cy = cy;
+		r.c = ComplexD((double)cx, (double)cy);
+		r.z.emplace_back(0.0, 0.0);
+
+		// Round the precision up to the size actually used, so the orbit is reusable for as deep as possible
+		r.bits = WithPrecision(PrecisionBits(pixelSize), [](auto tag) {
+			return decltype(tag)::FRACTION_BITS;
+			});
+		r.Extend(maxIter);
+		return r;
+	}
+
+	// Continues the orbit up to maxIter iterations unless it has already escaped
+	void Extend(int maxIter) {
+		WithPrecision(bits, [&](auto tag) {
+			Iterate<decltype(tag)>(maxIter);
+			});
+	}
+
+	// Number of iterations stored after z[0]. If the orbit has escaped this is less than the
+	// requested iteration count.
+	int Length() const {
+		return (int)z.size() - 1;
+	}
+
+	bool Escaped() const {
+		return z.back().AbsSquared() > 4.0;
+	}
+
+	std::vector<ComplexD> z;
+
+	// The point c at full precision, for placing other references relative to this one
+	Coord cx;
+	Coord cy;
+	ComplexD c;
+
+	// Fraction bits the orbit is iterated with
+	int bits = 0;
+
+private:
+
+	template <class Real>
+	void Iterate(int maxIter) {
+		Real x(zx);
+		Real y(zy);
+		Real cxr(cx);
+		Real cyr(cy);
+		z.reserve((size_t)maxIter + 1);
+
+		// Squaring is much cheaper than a general multiply, so 2xy is found as (x + y)^2 - x^2 - y^2
+		for (int i = Length(); i < maxIter && !Escaped(); i++) {
+			Real xx = x.Squared();
+			Real yy = y.Squared();
+			y = (x + y).Squared() - xx - yy + cyr;
+			x = xx - yy + cxr;
+			z.emplace_back((double)x, (double)y);
+		}
+
+		zx = Coord(x);
+		zy = Coord(y);
+	}
+
+	// The last z at full precision, for extending the orbit
+	Coord zx;
+	Coord zy;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include "FloatExp.h"
+#include "BigFixed.h"
+#include "Application.h"
+
+// Maps the pixels of one frame onto those of an earlier frame of a different view, so that work
+// already done for the earlier frame can stand in for the new one
+struct Reprojection {
+
+	// Pixels of the new frame map to x * scale + xOffset in the old one
+	double scale = 1.0;
+	double xOffset = 0.0;
+	double yOffset = 0.0;
+
+	// Both frames show a clientWidth by clientHeight view with a buffer of width by height pixels,
+	// which can be padded wider than the view
+	static Reprojection Between(const DeepViewport& from, const DeepViewport& to, int clientWidth, int clientHeight, int width, int height) {
+		Reprojection r;
+		r.scale = (double)(to.pixelSize / from.pixelSize);
+
+		// The offset between the top left pixels, in old pixels. Only the difference between the
+		// centres needs full precision.
+		double x = (double)(FloatExp(to.xCenter - from.xCenter) / from.pixelSize) - clientWidth * 0.5 * (r.scale - 1.0);
+		double y = (double)(FloatExp(to.yCenter - from.yCenter) / from.pixelSize) - clientHeight * 0.5 * (r.scale - 1.0);
+		r.xOffset = x * width / clientWidth;
+		r.yOffset = y * height / clientHeight;
+		return r;
+	}
+
+	// For frames of different sizes that are each a view of exactly their own size in pixels
+	static Reprojection Between(const DeepViewport& from, int fromWidth, int fromHeight, const DeepViewport& to, int toWidth, int toHeight) {
+		Reprojection r;
+		r.scale = (double)(to.pixelSize / from.pixelSize);
+		r.xOffset = (double)(FloatExp(to.xCenter - from.xCenter) / from.pixelSize) - toWidth * 0.5 * r.scale + fromWidth * 0.5;
+		r.yOffset = (double)(FloatExp(to.yCenter - from.yCenter) / from.pixelSize) - toHeight * 0.5 * r.scale + fromHeight * 0.5;
+		return r;
+	}
+
+	// The fraction of a new frame of toWidth by toHeight pixels that lies inside the old frame
+	double Overlap(int fromWidth, int fromHeight, int toWidth, int toHeight) const {
+		auto covered = [&](double offset, int from, int to) {
+			double extent = to * scale;
+			double first = std::max(offset, 0.0);
+			double last = std::min(offset + extent, (double)from);
+			return std::max(last - first, 0.0) / extent;
+		};
+		return covered(xOffset, fromWidth, toWidth) * covered(yOffset, fromHeight, toHeight);
+	}
+
+	// Sets (ox, oy) to the nearest old pixel to new pixel (x, y), and returns false if it is outside
+	// the old frame
+	bool Map(int x, int y, int width, int height, int& ox, int& oy) const {
+		ox = (int)std::lround(x * scale + xOffset);
+		oy = (int)std::lround(y * scale + yOffset);
+		return ox >= 0 && ox < width && oy >= 0 && oy < height;
+	}
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "Complex.h"
+#include "FloatExp.h"
+#include "ReferenceOrbit.h"
+
+// A truncated power series dz_n = a_1 dc + a_2 dc^2 + ... that holds for every pixel of a view
+// up to iteration skip, so pixels can start iterating there instead of from zero.
+// Coefficients are stored as a_k * radius^k to stay in range however deep the view is.
+template <class Real>
+struct SeriesApproximation {
+	using ComplexR = ComplexT<Real>;
+
+	static constexpr int MAX_TERMS = 32;
+	static constexpr int DEFAULT_TERMS = 16;
+
+	// Largest relative error in dz allowed at any probe point
+	static constexpr double TOLERANCE = 1e-12;
+
+	// Extends the series along ref for as long as it agrees with the directly perturbed orbits
+	// of the probe points. The probes should surround the view, e.g. its corners.
+	static SeriesApproximation Compute(const ReferenceOrbit& ref, const std::vector<ComplexR>& probes, int maxIter, int terms = DEFAULT_TERMS) {
+		SeriesApproximation sa;
+		sa.terms = std::clamp(terms, 1, MAX_TERMS);
+		for (const ComplexR& p : probes)
+			sa.radius = std::max(sa.radius, Sqrt(p.AbsSquared()));
+		if (sa.radius == Real(0.0))
+			return sa;
+
+		// Errors are compared relative to the radius, since squares of deep deltas underflow
+		Real invRadius = Real(1.0) / sa.radius;
+		std::vector<ComplexR> probeDz(probes.size());
+		std::array<ComplexR, MAX_TERMS> next{};
+
+		// At least one iteration is always left to the pixels so that they get an escape check
+		int maxSkip = std::min(maxIter, ref.Length()) - 1;
+		for (int n = 0; n < maxSkip; n++) {
+
+			// dz_{n+1} = 2 Z_n dz_n + dz_n^2 + dc, expanded term by term
+			ComplexR twoZ(ref.z[n] * 2.0);
+			for (int k = 0; k < sa.terms; k++) {
+				ComplexR a = twoZ * sa.coeffs[k];
+				for (int i = 0; i < k; i++)
+					a = a + sa.coeffs[i] * sa.coeffs[k - 1 - i];
+				next[k] = a;
+			}
+			next[0] = next[0] + ComplexR(sa.radius, Real(0.0));
+
+			for (size_t p = 0; p < probes.size(); p++) {
+				ComplexR& dz = probeDz[p];
+				dz = twoZ * dz + dz.Squared() + probes[p];
+
+				ComplexR err = (Evaluate(next, sa.terms, probes[p] * invRadius) - dz) * invRadius;
+				ComplexR dzNormalised = dz * invRadius;
+				if (err.AbsSquared() > Real(TOLERANCE * TOLERANCE) * dzNormalised.AbsSquared())
+					return sa;
+				ComplexR z = ComplexR(ref.z[n + 1]) + dz;
+				if (z.AbsSquared() > Real(4.0))
+					return sa;
+			}
+
+			sa.coeffs = next;
+			sa.skip = n + 1;
+		}
+		return sa;
+	}
+
+	// Approximates dz at iteration skip
+	ComplexR Evaluate(ComplexR dc) const {
+		if (skip == 0)
+			return ComplexR();
+		return Evaluate(coeffs, terms, dc * (Real(1.0) / radius));
+	}
+
+	int skip = 0;
+	int terms = 0;
+	Real radius = 0.0;
+	std::array<ComplexR, MAX_TERMS> coeffs{};
+
+private:
+
+	static ComplexR Evaluate(const std::array<ComplexR, MAX_TERMS>& coeffs, int terms, ComplexR u) {
+		ComplexR sum;
+		for (int k = terms - 1; k >= 0; k--)
+			sum = (sum + coeffs[k]) * u;
+		return sum;
+	}
+};
@@ -3,17 +3,84 @@
 #include <future>
 #include <utility>
 #include <type_traits>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+// A flag shared between the owner of some work and the work, which checks it between rows or tiles
+// and stops early once it is set. Copies share the same flag.
+struct CancellationToken {
+
+	CancellationToken() :
+		cancelled(std::make_shared<std::atomic<bool>>(false))
+	{
+	}
+
+	void Cancel() const {
+		*cancelled = true;
+	}
+
+	bool IsCancelled() const {
+		return *cancelled;
+	}
+
+private:
+	std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+// Called on a task's thread once the task finishes and its result is ready, for the tasks whose
+// owner polls them and wants to know when to look, such as the main loop waking itself up
+struct OnFinished {
+	std::function<void()> notify;
+};
 
 template <class Result>
 struct Task {
 
 	template <class Fn, class... Args> requires std::is_same_v<Result, std::invoke_result_t<Fn, Args...>>
 	Task(Fn&& fn, Args&&... args) :
-		f(std::async(std::launch::async, std::forward<Fn>(fn), std::forward<Args>(args)...)),
-		complete(false)
+		Task(CancellationToken(), std::forward<Fn>(fn), std::forward<Args>(args)...)
 	{
 	}
 
+	// Like the other constructor, and Cancel cancels token, which fn should check
+	template <class Fn, class... Args> requires std::is_same_v<Result, std::invoke_result_t<Fn, Args...>>
+	Task(CancellationToken token, Fn&& fn, Args&&... args) :
+		Task(std::move(token), OnFinished(), std::forward<Fn>(fn), std::forward<Args>(args)...)
+	{
+	}
+
+	// Like the other constructors, and onFinished is notified once the result is ready
+	template <class Fn, class... Args> requires std::is_same_v<Result, std::invoke_result_t<Fn, Args...>>
+	Task(CancellationToken token, OnFinished onFinished, Fn&& fn, Args&&... args) :
+		complete(false),
+		token(std::move(token))
+	{
+		// The result is set through a promise so that it is ready before onFinished is notified
+		auto promise = std::make_shared<std::promise<Result>>();
+		f = promise->get_future();
+		thread = std::async(std::launch::async, [promise, notify = std::move(onFinished.notify), fn = std::forward<Fn>(fn), ...args = std::forward<Args>(args)]() mutable {
+			try {
+				promise->set_value(std::invoke(std::move(fn), std::move(args)...));
+			} catch (...) {
+				promise->set_exception(std::current_exception());
+			}
+			if (notify)
+				notify();
+			});
+	}
+
+	// Asks the task to stop early. Its result is then incomplete and should be thrown away.
+	void Cancel() {
+		token.Cancel();
+	}
+
+	// Returns true if the task has finished, so that destroying it won't block
+	bool IsFinished() const {
+		return thread.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
 	// Returns true if the task completed and stores the result in res. Otherwise returns false
 	bool PollCompletion(Result& res) {
 		if (complete) {
@@ -34,5 +101,7 @@ struct Task {
 
 private:
 	std::future<Result> f;
+	std::future<void> thread;
 	bool complete;
+	CancellationToken token;
 };
@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+
+// A fixed set of worker threads that run jobs in the order they were submitted, except that low
+// priority jobs only run while there are no others. Unlike Task, which starts a thread for each
+// call, it suits many small jobs.
+// A job must not wait on another job of the same pool, or every worker could end up waiting.
+struct ThreadPool {
+
+	enum class Priority {
+		Normal,
+		Low,
+	};
+
+	ThreadPool(int threads) {
+		for (int i = 0; i < std::max(1, threads); i++)
+			workers.emplace_back([this] { Work(); });
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Finishes the jobs already submitted before returning
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	template <class Fn>
+	std::future<std::invoke_result_t<Fn>> Submit(Fn fn, Priority priority = Priority::Normal) {
+		using Result = std::invoke_result_t<Fn>;
+		auto job = std::make_shared<std::packaged_task<Result()>>(std::move(fn));
+		std::future<Result> f = job->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			(priority == Priority::Low ? lowJobs : jobs).push_back([job] { (*job)(); });
+		}
+		wake.notify_one();
+		return f;
+	}
+
+	int Size() const {
+		return (int)workers.size();
+	}
+
+private:
+
+	void Work() {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !jobs.empty() || !lowJobs.empty(); });
+				auto& queue = jobs.empty() ? lowJobs : jobs;
+				if (queue.empty())
+					return;
+				job = std::move(queue.front());
+				queue.pop_front();
+			}
+			job();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::deque<std::function<void()>> lowJobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
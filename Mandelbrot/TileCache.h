@@ -0,0 +1,238 @@
+#pragma once
+#include <map>
+#include <list>
+#include <tuple>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <future>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include "Task.h"
+#include "FloatExp.h"
+#include "BigFixed.h"
+#include "ThreadPool.h"
+#include "Tiles.h"
+#include "Mandelbrot.h"
+#include "Application.h"
+
+// Iteration counts of tiles of a pixel grid, kept between frames so that the tiles a view shares
+// with an earlier frame, or with tiles rendered speculatively ahead of the camera, aren't rendered
+// again. Each pixel size has its own grid and all grids are aligned to a common origin.
+struct TileCache {
+
+	static constexpr size_t CAPACITY = 2048;
+
+	// Speculative tiles beyond this many are not worth the memory or the work
+	static constexpr size_t MAX_SPECULATIVE_TILES = 64;
+
+	// A view snapped to the grid of its pixel size, with its top left pixel at grid pixel (x, y).
+	// Grid views from before the origin last moved no longer match any tiles.
+	struct GridView {
+		int64_t origin = 0;
+		FloatExp pixelSize;
+		int64_t x = 0;
+		int64_t y = 0;
+		int width = 0;
+		int height = 0;
+	};
+
+	// Snaps a view of width by height pixels to the nearest pixel of its grid. The origin moves to
+	// the view, losing every tile, if it is so far away that pixel offsets would lose precision.
+	GridView Snap(const DeepViewport& view, int width, int height) {
+		std::lock_guard<std::mutex> lock(mutex);
+		double x = 0.0;
+		double y = 0.0;
+		if (hasOrigin) {
+			x = (double)(FloatExp(view.xCenter - xOrigin) / view.pixelSize);
+			y = (double)(FloatExp(view.yCenter - yOrigin) / view.pixelSize);
+		}
+		if (!hasOrigin || std::abs(x) > MAX_OFFSET || std::abs(y) > MAX_OFFSET) {
+			xOrigin = view.xCenter;
+			yOrigin = view.yCenter;
+			hasOrigin = true;
+			origin++;
+			tiles.clear();
+			recent.clear();
+			x = 0.0;
+			y = 0.0;
+		}
+
+		GridView g;
+		g.origin = origin;
+		g.pixelSize = view.pixelSize;
+		g.x = (int64_t)std::llround(x - width * 0.5);
+		g.y = (int64_t)std::llround(y - height * 0.5);
+		g.width = width;
+		g.height = height;
+		return g;
+	}
+
+	// The view that a grid view shows
+	DeepViewport View(const GridView& g) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		DeepViewport view;
+		view.xCenter = xOrigin + Coord(FloatExp((double)g.x + g.width * 0.5) * g.pixelSize);
+		view.yCenter = yOrigin + Coord(FloatExp((double)g.y + g.height * 0.5) * g.pixelSize);
+		view.pixelSize = g.pixelSize;
+		return view;
+	}
+
+	// Renders a grid view from cached tiles, rendering the missing ones on the pool with sample,
+	// which takes pixel coordinates of the view. Sets rendered to the number of missing tiles. Tiles
+	// cut short by cancel are left 0 and aren't cached. The frame reuses the memory of into.
+	Mandelbrot Render(const GridView& g, const Mandelbrot::Sampler& sample, ThreadPool& pool, int& rendered, CancellationToken cancel = {}, Mandelbrot into = {}) {
+		Mandelbrot m = Mandelbrot::Blank(g.width, g.height, std::move(into));
+
+		std::vector<std::future<void>> jobs;
+		rendered = 0;
+		ForEachTile(g, [&](int64_t tx, int64_t ty) {
+			Key key = MakeKey(g, tx, ty);
+			if (Counts counts = Find(key)) {
+				CopyTile(m, g, tx, ty, *counts);
+				return;
+			}
+			rendered++;
+			jobs.push_back(pool.Submit([&, key, tx, ty] {
+				if (Counts counts = RenderTile(g, tx, ty, g.pixelSize, sample, cancel)) {
+					Insert(key, counts);
+					CopyTile(m, g, tx, ty, *counts);
+				}
+				}));
+			});
+		for (auto& job : jobs)
+			job.get();
+		return m;
+	}
+
+	// Renders the tiles of predicted that aren't cached yet at low priority, nearest to the frame
+	// first, and cancels the tiles of the previous prediction that haven't started. sample is the
+	// frame's, which can sample any point of the plane with coordinates relative to its pixels.
+	void Speculate(const GridView& frame, const GridView& predicted, const Mandelbrot::Sampler& sample, ThreadPool& pool) {
+		CancelSpeculation();
+		CancellationToken cancel;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			speculation = cancel;
+		}
+
+		// Distance of each missing tile from the centre of the frame, in frame pixels
+		double scale = (double)(predicted.pixelSize / frame.pixelSize);
+		double xCentre = frame.x + frame.width * 0.5;
+		double yCentre = frame.y + frame.height * 0.5;
+		std::vector<std::tuple<double, int64_t, int64_t>> missing;
+		ForEachTile(predicted, [&](int64_t tx, int64_t ty) {
+			if (Find(MakeKey(predicted, tx, ty)))
+				return;
+			double dx = ((tx + 0.5) * TileScheduler::TILE_SIZE) * scale - xCentre;
+			double dy = ((ty + 0.5) * TileScheduler::TILE_SIZE) * scale - yCentre;
+			missing.emplace_back(dx * dx + dy * dy, tx, ty);
+			});
+		std::sort(missing.begin(), missing.end());
+		if (missing.size() > MAX_SPECULATIVE_TILES)
+			missing.resize(MAX_SPECULATIVE_TILES);
+
+		for (const auto& [distance, tx, ty] : missing) {
+			pool.Submit([this, frame, predicted, sample, cancel, tx, ty] {
+				Key key = MakeKey(predicted, tx, ty);
+				if (cancel.IsCancelled() || Find(key))
+					return;
+				if (Counts counts = RenderTile(frame, tx, ty, predicted.pixelSize, sample, cancel))
+					Insert(key, counts);
+				}, ThreadPool::Priority::Low);
+		}
+	}
+
+	void CancelSpeculation() {
+		std::lock_guard<std::mutex> lock(mutex);
+		speculation.Cancel();
+	}
+
+private:
+
+	using Counts = std::shared_ptr<const std::vector<int>>;
+
+	// The origin, the pixel size's exponent and mantissa, and the tile's position in its grid
+	using Key = std::tuple<int64_t, int64_t, double, int64_t, int64_t>;
+
+	static Key MakeKey(const GridView& g, int64_t tx, int64_t ty) {
+		return Key(g.origin, g.pixelSize.exponent, g.pixelSize.mantissa, tx, ty);
+	}
+
+	// Calls fn with the grid position of each tile overlapping the view
+	template <class Fn>
+	static void ForEachTile(const GridView& g, Fn fn) {
+		constexpr int64_t T = TileScheduler::TILE_SIZE;
+		auto floorDiv = [](int64_t a) { return a >= 0 ? a / T : -((-a + T - 1) / T); };
+		for (int64_t ty = floorDiv(g.y); ty <= floorDiv(g.y + g.height - 1); ty++)
+			for (int64_t tx = floorDiv(g.x); tx <= floorDiv(g.x + g.width - 1); tx++)
+				fn(tx, ty);
+	}
+
+	// Renders a tile of the grid of the given pixel size, using a sampler whose pixel coordinates are
+	// those of the grid view frame. Returns null if cancelled part way.
+	static Counts RenderTile(const GridView& frame, int64_t tx, int64_t ty, const FloatExp& pixelSize, const Mandelbrot::Sampler& sample, const CancellationToken& cancel) {
+		constexpr int T = TileScheduler::TILE_SIZE;
+		double scale = (double)(pixelSize / frame.pixelSize);
+		auto counts = std::make_shared<std::vector<int>>((size_t)T * T);
+		for (int y = 0; y < T; y++) {
+			if (cancel.IsCancelled())
+				return nullptr;
+			double sy = (double)(ty * T + y) * scale - frame.y;
+			for (int x = 0; x < T; x++) {
+				double sx = (double)(tx * T + x) * scale - frame.x;
+				(*counts)[(size_t)y * T + x] = sample(sx, sy);
+			}
+		}
+		return counts;
+	}
+
+	// Copies the part of a tile that overlaps the view into it
+	static void CopyTile(Mandelbrot& m, const GridView& g, int64_t tx, int64_t ty, const std::vector<int>& counts) {
+		constexpr int T = TileScheduler::TILE_SIZE;
+		int64_t x0 = std::max(tx * T, g.x);
+		int64_t x1 = std::min(tx * T + T, g.x + g.width);
+		int64_t y0 = std::max(ty * T, g.y);
+		int64_t y1 = std::min(ty * T + T, g.y + g.height);
+		for (int64_t y = y0; y < y1; y++) {
+			const int* src = &counts[(size_t)((y - ty * T) * T + (x0 - tx * T))];
+			std::copy(src, src + (x1 - x0), &m.iterCounts[(size_t)((y - g.y) * g.width + (x0 - g.x))]);
+		}
+	}
+
+	Counts Find(const Key& key) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = tiles.find(key);
+		if (it == tiles.end())
+			return nullptr;
+		recent.splice(recent.begin(), recent, it->second.second);
+		return it->second.first;
+	}
+
+	// Adds a tile, dropping the least recently used once full. Tiles rendered for an old origin
+	// are dropped straight away.
+	void Insert(const Key& key, Counts counts) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (std::get<0>(key) != origin || tiles.count(key))
+			return;
+		recent.push_front(key);
+		tiles.emplace(key, std::make_pair(std::move(counts), recent.begin()));
+		if (tiles.size() > CAPACITY) {
+			tiles.erase(recent.back());
+			recent.pop_back();
+		}
+	}
+
+	// Pixel offsets from the origin stay exact in double well beyond this
+	static constexpr double MAX_OFFSET = 0x1p40;
+
+	mutable std::mutex mutex;
+	bool hasOrigin = false;
+	int64_t origin = 0;
+	Coord xOrigin;
+	Coord yOrigin;
+	std::map<Key, std::pair<Counts, std::list<Key>::iterator>> tiles;
+	std::list<Key> recent;
+	CancellationToken speculation;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "Tiles.h"
+
+// The colours of a rendered tile of the frame with the given id
+struct FinishedTile {
+	int64_t frame = 0;
+	Tile tile{};
+	std::vector<uint8_t> px;
+};
+
+// Passes finished tiles from the workers to the main thread without locking. Workers push onto a
+// linked stack, and the main thread takes the whole stack at once, so nodes are never popped one at
+// a time and a node can't be reused under a pusher (the ABA problem).
+struct TileQueue {
+
+	TileQueue() = default;
+	TileQueue(const TileQueue&) = delete;
+	TileQueue& operator=(const TileQueue&) = delete;
+
+	~TileQueue() {
+		Drain();
+	}
+
+	// Can be called from any thread
+	void Push(FinishedTile tile) {
+		Node* node = new Node{ std::move(tile), head.load(std::memory_order_relaxed) };
+		while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+			;
+	}
+
+	// Takes every tile pushed so far, oldest first. Only one thread can drain the queue.
+	std::vector<FinishedTile> Drain() {
+		Node* node = head.exchange(nullptr, std::memory_order_acquire);
+		std::vector<FinishedTile> tiles;
+		while (node) {
+			tiles.push_back(std::move(node->tile));
+			Node* next = node->next;
+			delete node;
+			node = next;
+		}
+		std::reverse(tiles.begin(), tiles.end());
+		return tiles;
+	}
+
+private:
+
+	struct Node {
+		FinishedTile tile;
+		Node* next;
+	};
+
+	std::atomic<Node*> head = nullptr;
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <vector>
+#include <future>
+#include <algorithm>
+#include <utility>
+#include "Task.h"
+#include "ThreadPool.h"
+
+// A rectangle of a frame in pixels
+struct Tile {
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+// Splits frames into tiles and runs them on a pool, most important first
+struct TileScheduler {
+
+	static constexpr int TILE_SIZE = 64;
+
+	static std::vector<Tile> Split(int width, int height) {
+		std::vector<Tile> tiles;
+		for (int y = 0; y < height; y += TILE_SIZE)
+			for (int x = 0; x < width; x += TILE_SIZE)
+				tiles.push_back(Tile{ x, y, std::min(TILE_SIZE, width - x), std::min(TILE_SIZE, height - y) });
+		return tiles;
+	}
+
+	// A priority that orders the tiles of a width by height frame from the centre outwards
+	static auto FromCentre(int width, int height) {
+		return [=](const Tile& tile) {
+			double dx = tile.x + tile.width * 0.5 - width * 0.5;
+			double dy = tile.y + tile.height * 0.5 - height * 0.5;
+			return dx * dx + dy * dy;
+		};
+	}
+
+	// Sorts tiles into increasing order of priority(tile), keeping the order of equal ones
+	template <class Priority>
+	static void Order(std::vector<Tile>& tiles, Priority priority) {
+		std::vector<std::pair<double, Tile>> keyed;
+		for (const Tile& tile : tiles)
+			keyed.emplace_back(priority(tile), tile);
+		std::stable_sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) {
+			return a.first < b.first;
+			});
+		for (size_t i = 0; i < tiles.size(); i++)
+			tiles[i] = keyed[i].second;
+	}
+
+	// Runs fn on each tile of a width by height frame on the pool and waits for them all. Tiles are
+	// started in increasing order of priority(tile), so the lowest finish first. Tiles that haven't
+	// started when cancel is set are skipped.
+	template <class Priority, class Fn>
+	static void Run(int width, int height, ThreadPool& pool, Priority priority, Fn fn, CancellationToken cancel = {}) {
+		std::vector<Tile> tiles = Split(width, height);
+		Order(tiles, priority);
+
+		std::vector<std::future<void>> jobs;
+		for (const Tile& tile : tiles)
+			jobs.push_back(pool.Submit([&fn, &cancel, tile] {
+				if (!cancel.IsCancelled())
+					fn(tile);
+				}));
+		for (auto& job : jobs)
+			job.get();
+	}
+};
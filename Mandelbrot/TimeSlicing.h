@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "Tiles.h"
+#include "Mandelbrot.h"
+
+// A frame rendered a time slice at a time on the calling thread, so that frames that take longer
+// than the time between presents don't hold up the main loop. The frame is rendered in bands of
+// rows from the centre outwards with the same kernels as a whole frame, and remembers how far it
+// got between slices.
+struct SlicedFrame {
+
+	static constexpr int BAND_ROWS = 16;
+
+	// The frame is rendered in place into the memory of into
+	SlicedFrame(Mandelbrot::Bands bands, Mandelbrot into = {}) :
+		bands(std::move(bands))
+	{
+		m = this->bands.Start(std::move(into));
+		for (int y = 0; y < m.height; y += BAND_ROWS)
+			rows.push_back(Tile{ 0, y, m.width, std::min(BAND_ROWS, m.height - y) });
+		TileScheduler::Order(rows, TileScheduler::FromCentre(m.width, m.height));
+	}
+
+	// Renders bands until budget seconds have passed, then finishes the frame once every band is
+	// done, and returns true once it is. A band started before the deadline is finished, so a slice
+	// can overrun by up to one band, or by finishing the frame.
+	bool Advance(double budget) {
+		auto start = std::chrono::steady_clock::now();
+		auto deadline = start + std::chrono::duration<double>(budget);
+		while (!complete && std::chrono::steady_clock::now() < deadline) {
+			if (nextBand < rows.size()) {
+				const Tile& band = rows[nextBand++];
+				bands.Render(m, band.y, band.height);
+			} else {
+				bands.Finish(m);
+				complete = true;
+			}
+		}
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return complete;
+	}
+
+	bool IsComplete() const {
+		return complete;
+	}
+
+	// How long the slices have taken so far, without the time between them
+	double Seconds() const {
+		return seconds;
+	}
+
+	// The bands not rendered yet
+	std::vector<Tile> Remaining() const {
+		return std::vector<Tile>(rows.begin() + nextBand, rows.end());
+	}
+
+	// The iteration counts so far, which are 0 in the remaining bands
+	const Mandelbrot& Result() const {
+		return m;
+	}
+
+	Mandelbrot TakeResult() {
+		return std::move(m);
+	}
+
+private:
+
+	Mandelbrot::Bands bands;
+	std::vector<Tile> rows;
+	size_t nextBand = 0;
+	bool complete = false;
+	double seconds = 0.0;
+	Mandelbrot m;
+};